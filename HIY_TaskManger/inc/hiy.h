@@ -1,4 +1,4 @@
-/* Do not modify this file */
+/* Common includes and constants of HIY. */
 
 #ifndef TASKMNTR_H
 #define TASKMNTR_H
@@ -17,7 +17,6 @@
 
 
 /* Constants */
-#define MAXLINE 100 /* the max number of chars in one command line */
 #define MAXARGS 25 /* the max number of arguments for one program */
 
 #endif /*TASKMNTR_H*/
@@ -1,4 +1,4 @@
-/* Do not modify this file */
+/* Logging for HIY: the messages HIY prints, and their buffering. */
 #ifndef LOGGING_H
 #define LOGGING_H
 
@@ -11,6 +11,7 @@
 #define LOG_STATE_SUSPENDED  3
 #define LOG_STATE_FINISHED   4
 #define LOG_STATE_KILLED     5
+#define LOG_STATE_QUEUED     6
 
 #define STATE_READY      0
 #define STATE_RUN_FG     1
@@ -18,6 +19,7 @@
 #define STATE_SUSPENDED  3
 #define STATE_FINISHED   4
 #define STATE_KILLED     5
+#define STATE_QUEUED     6
 
 #define LOG_CMD_SUSPEND 0
 #define LOG_CMD_RESUME  1
@@ -34,22 +36,33 @@ void log_hiy_prompt();
 void log_hiy_help();
 void log_hiy_quit();
 
+/* Buffering: buffered messages are written by log_hiy_flush() */
+void log_hiy_buffer(int buffered);
+void log_hiy_flush();
+
 /* Task information and management */
 void log_hiy_task_init(int task_num, const char *cmd);
 void log_hiy_num_tasks(int num_tasks);
 void log_hiy_task_info(int task_num, const char* cmd, int status, int pid, int exit_code);
 void log_hiy_delete(int task_num);
 void log_hiy_status(int task_num, const char *cmd, int pid, int from, int to);
+void log_hiy_queue(int task_num, const char *cmd, int priority);
+void log_hiy_unqueue(int task_num, const char *cmd);
+void log_hiy_task_usage(int task_num, double wall, double user, double sys, long max_rss_kb, long vol_switches, long invol_switches, long long cg_cpu_usec, long long cg_memory_peak);
+const char *log_hiy_state_name(int status);
+void log_hiy_limits(int task_num, int cpu_max, long long memory_max, const char *cpus);
 
 /* Redirection */
 void log_hiy_redir(int task_num, int redir_type, const char *file);
 void log_hiy_pipe(int task_num1, int task_num2);
+void log_hiy_stages_error(int max_stages);
 
 /* Errors */
 void log_hiy_task_num_error(int task_num);
 void log_hiy_status_error(int task_num, int status);
 void log_hiy_start_error(const char *line);
 void log_hiy_file_error(int task_num, const char *file);
+void log_hiy_limit_error(int task_num, const char *setting);
 void log_hiy_pipe_error(int task_num);
 
 /* Signals */
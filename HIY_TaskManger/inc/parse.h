@@ -1,10 +1,15 @@
-/* Do not modify this file */
+/* The parsing facility of HIY: commands, task numbers, files and limits. */
 
 #ifndef PARSE_H
 #define PARSE_H
 
 #include <ctype.h> /* isspace */
 
+#define MAXSTAGES 16 /* the max number of tasks in one pipe or tee */
+#define STAGES_INVALID -1 /* num_count of a list with too many numbers, or a token that is not one */
+#define LIMIT_QUEUE 0 /* the Task Number of limit queue */
+#define LIMIT_INVALID -1 /* cpu_max of a limit with a setting that cannot be read */
+
 /* Types: Instruction.
  *
  * This is a record which keeps information about which instruction we're execting.
@@ -12,8 +17,15 @@
  * instruct field: This holds the name of the instruction which we're exectuing 
  *          (e.g. "start", "startbg", "list", "kill", "help", "quit", ...). 
  * num field: This holds the Task Number of the task which the command is being 
- *          applied to. 
- * num2 field: This holds the Task Number of the second task, if applicable
+ *          applied to, or LIMIT_QUEUE for limit queue.
+ * num2 field: This holds the Task Number of the second task, if applicable,
+ *          or the priority for queue
+ * nums field: This holds all the Task Numbers of a pipe or tee, in order,
+ *          and num_count how many there are, or STAGES_INVALID if the list
+ *          has more than MAXSTAGES numbers or a token that is not a number.
+ * cpu_max, memory_max, cpus fields: These hold the settings of limit, as
+ *          cpu=PERCENT, mem=SIZE[K|M|G] and cpus=LIST, 0 or NULL if not given.
+ *          cpu_max is LIMIT_INVALID if a setting cannot be read.
  * infile field: If the command has an associated input filename,  the filename 
  *          goes here.  If there is no associated file, then this field will be NULL.
  * outfile field: If the command has an associated output filename,  the filename 
@@ -28,6 +40,11 @@ typedef struct instruction_struct{
                           // or 0 if none/default
 	int num2;         // the 2nd Task Number associated with the instruction, 
                           // or 0 if none/default
+	int nums[MAXSTAGES]; // all the Task Numbers of a pipe or tee
+	int num_count;    // the number of Task Numbers in nums
+	int cpu_max;      // the CPU limit, in percent of one CPU, or 0 if none
+	long long memory_max; // the memory limit in bytes, or 0 if none
+	char *cpus;       // the CPUs the task may run on, or NULL if any
 	char *infile;     // the input filename associated with the instruction
 	char *outfile;    // the input filename associated with the instruction
 } Instruction;
@@ -74,7 +91,6 @@ int is_whitespace(const char *str);
  *         initialize_instruction() and initialize_command() will not malloc
  *         a new Instruction if the input is NULL. 
  */
-char *get_input();
 int initialize_instruction(Instruction *inst);
 int initialize_argv(char *argv[]);
 int initialize_command(Instruction *inst, char *argv[]);  
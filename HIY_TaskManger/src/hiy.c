@@ -1,5 +1,15 @@
 
+#define _GNU_SOURCE // pipe2, splice, tee and syscall
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include <time.h>
 #include "hiy.h"
 #include "parse.h"
 #include "util.h"
@@ -14,22 +24,89 @@ static const char *task_path[] = {"./", "/usr/bin/", NULL};
 
 #define NUM_PATHS (sizeof(task_path)/sizeof(const char*) - 1)
 
+#define MIN_TABLE_SIZE 64 // initial size of the task number and pid tables
+#define SIG_BATCH 16 // number of signals read from sig_fd at once
+#define INPUT_SIZE 4096 // size of the command input buffer
+#define RELAY_CHUNK 65536 // most bytes a relay takes from its producer at once
+#define CGROUP_NAME_SIZE 64 // size of a task cgroup file name
+#define CGROUP_FILE_SIZE 1024 // most bytes read from a cgroup file
+#define CGROUP_QUEUE "queue" // cgroup under --cgroup holding the cgroups of queued tasks
+#define CPU_PERIOD 100000 // cpu.max period in microseconds
+
+// Limits structure: resource limits written to a cgroup
+typedef struct limits_st {
+  int cpu_max; // CPU limit in percent of one CPU, 0 if none
+  long long memory_max; // memory limit in bytes, 0 if none
+  char* cpus; // CPUs to run on as a cpuset list, NULL if any
+} Limits;
+
 // Task structure
 typedef struct task_st {
   unsigned int num; // task number
   pid_t pid; // process id
+  pid_t pgid; // process group id, shared by the tasks of a pipe or tee
   unsigned short state; // task state
   int exit_code; // task exit code
   bool is_fg; // foreground flag
+  bool holds_slot; // started from the queue, and holding a scheduler slot
+  int priority; // queue priority, higher starts first
+  unsigned int queue_seq; // queue arrival order, for equal priorities
   char* cmd; // task command
   char** argv; // task command arguments
+  char* path; // program path, resolved on the first start
+  struct timespec started; // start time of the last run
+  struct timespec ended; // end time of the last run
+  struct rusage usage; // resource usage of the last run, from wait4
+  long long cg_cpu_usec; // CPU time of the last run's cgroup, -1 if unknown
+  long long cg_memory_peak; // peak memory of the last run's cgroup in bytes, -1 if unknown
+  Limits limits; // resource limits of the task's cgroup
+  bool in_queue_cgroup; // the last run was started from the queue, in its cgroup
   struct task_st* next; // pointer to the next task
+  struct task_st* prev; // pointer to the previous task
+  struct task_st* pid_next; // pointer to the next task in the same pid bucket
 } Task;
 
+// Relay structure: copies the output of a tee producer to its consumers
+typedef struct relay_st {
+  int in; // read end of the producer's pipe
+  int outs[MAXSTAGES]; // write ends of the consumers' pipes, -1 once closed
+  int num_outs; // number of consumers
+  char* chunk; // bytes some consumers could not take without blocking
+  size_t chunk_length; // length of the chunk, 0 if every consumer is up to date
+  size_t sent[MAXSTAGES]; // bytes of the chunk each consumer has taken
+  struct relay_st* next; // pointer to the next relay
+} Relay;
+
 Task* tasks = NULL; // initialize linked list for tasks
+Task* tasks_tail = NULL; // last task in the list, for appending
+Task** task_table = NULL; // tasks indexed by task number, NULL once deleted
+unsigned int task_table_size = 0; // number of slots in task_table
+Task** pid_table = NULL; // hash buckets of started tasks keyed by pid
+unsigned int pid_table_size = 0; // number of buckets, a power of two
+unsigned int pid_count = 0; // number of tasks in pid_table
 unsigned int task_id = 1; // set task id to 1 initially
 unsigned int task_number = 0; // number of tasks
-sigset_t mask, old_mask; // masks for signals
+sigset_t mask, old_mask; // signals handled through sig_fd, and the mask to restore in children
+int sig_fd = -1; // signalfd queueing the signals in mask
+char input[INPUT_SIZE]; // command input read but not yet returned
+size_t input_start = 0, input_end = 0; // unread part of input
+bool input_eof = false; // standard input reached its end
+Relay* relays = NULL; // relays of the running tees
+Task** queue = NULL; // heap of the queued tasks, see queue_before
+unsigned int queue_length = 0; // number of queued tasks
+unsigned int queue_capacity = 0; // number of slots in queue
+unsigned int queue_arrivals = 0; // arrival counter of the queue
+unsigned int max_slots = 1; // most tasks started from the queue running at once
+unsigned int slots_used = 0; // tasks started from the queue still running
+int cgroup_fd = -1; // --cgroup directory holding a cgroup per task, -1 if not used
+int queue_cgroup_fd = -1; // cgroup holding the cgroups of queued tasks, -1 if not used
+Limits queue_limits = {0, 0, NULL}; // resource limits shared by all queued tasks
+char* batch = NULL; // mapped batch file, NULL when reading commands from stdin
+size_t batch_size = 0; // size of the batch file
+size_t batch_start = 0; // offset of the next command in the batch file
+
+int handle_signals(); // defined with the signal handlers below
+void unqueue_task(Task* task); // defined with the queue below
 unsigned int task_to_promote = 0; // task number to promote to foreground
 
 // Function is_busy - checks if a task is busy or not
@@ -38,7 +115,7 @@ unsigned int task_to_promote = 0; // task number to promote to foreground
 // Output
 //   true if busy, false if not
 bool is_busy(unsigned short state) {
-  return (state == LOG_STATE_RUN_FG) || (state == LOG_STATE_RUN_BG) || (state == LOG_STATE_SUSPENDED);
+  return (state == LOG_STATE_RUN_FG) || (state == LOG_STATE_RUN_BG) || (state == LOG_STATE_SUSPENDED) || (state == LOG_STATE_QUEUED);
 }
 
 // Function free_task - frees allocated memory for a task
@@ -47,6 +124,8 @@ bool is_busy(unsigned short state) {
 void free_task(Task* task) {
   free(task->cmd);
   free_argv(task->argv);
+  free(task->path);
+  free(task->limits.cpus);
   free(task);
 }
 
@@ -59,6 +138,80 @@ void free_tasks() {
     tasks = tasks->next;
     free_task(temp);
   }
+  tasks_tail = NULL;
+  free(task_table);
+  free(pid_table);
+  free(queue);
+  task_table = NULL;
+  pid_table = NULL;
+  queue = NULL;
+}
+
+// Note: the signals are handled from the main loop through sig_fd, so the
+// list and the tables below never change under a running handler.
+
+// Function pid_bucket - finds the pid_table bucket of a process id
+// Input
+//   pid_t pid - process id
+// Output
+//   index of the bucket
+unsigned int pid_bucket(pid_t pid) {
+  // Multiplicative hashing spreads consecutive pids over the buckets
+  return ((unsigned int)pid * 2654435761u) & (pid_table_size - 1);
+}
+
+// Function pid_table_remove - removes a task from the pid table
+// Input
+//   Task* task - task to remove, does nothing if it is not in the table
+void pid_table_remove(Task* task) {
+  if (pid_table == NULL) {
+    return;
+  }
+  Task** link = &pid_table[pid_bucket(task->pid)];
+  while (*link != NULL) {
+    if (*link == task) {
+      *link = task->pid_next;
+      task->pid_next = NULL;
+      pid_count--;
+      return;
+    }
+    link = &(*link)->pid_next;
+  }
+}
+
+// Function pid_table_insert - adds a started task to the pid table,
+//                             doubling the table when it gets full
+// Input
+//   Task* task - task with its pid set
+void pid_table_insert(Task* task) {
+  if (pid_count >= pid_table_size) {
+    unsigned int old_size = pid_table_size;
+    Task** old_table = pid_table;
+    unsigned int new_size = (old_size == 0) ? MIN_TABLE_SIZE : 2 * old_size;
+    Task** new_table = (Task**)calloc(new_size, sizeof(Task*));
+    // If error, exit
+    if (new_table == NULL) {
+      exit(1);
+    }
+    // Move every task to its bucket in the new table
+    pid_table = new_table;
+    pid_table_size = new_size;
+    for (unsigned int i = 0; i < old_size; i++) {
+      Task* temp = old_table[i];
+      while (temp != NULL) {
+        Task* next = temp->pid_next;
+        unsigned int bucket = pid_bucket(temp->pid);
+        temp->pid_next = pid_table[bucket];
+        pid_table[bucket] = temp;
+        temp = next;
+      }
+    }
+    free(old_table);
+  }
+  unsigned int bucket = pid_bucket(task->pid);
+  task->pid_next = pid_table[bucket];
+  pid_table[bucket] = task;
+  pid_count++;
 }
 
 // Function add_task - adds a task to the global linked list of tasks
@@ -75,334 +228,1348 @@ void add_task(char* cmd, char** argv) {
   // Otherwise, set all the fields
   new_task->num = task_id;
   new_task->pid = 0;
+  new_task->pgid = 0;
   new_task->state = STATE_READY;
   new_task->exit_code = 0;
   new_task->is_fg = false;
+  new_task->holds_slot = false;
+  new_task->priority = 0;
+  new_task->queue_seq = 0;
   new_task->cmd = string_copy(cmd);
   new_task->argv = clone_argv(argv);
+  new_task->path = NULL;
+  memset(&new_task->usage, 0, sizeof(new_task->usage));
+  new_task->cg_cpu_usec = -1;
+  new_task->cg_memory_peak = -1;
+  new_task->limits.cpu_max = 0;
+  new_task->limits.memory_max = 0;
+  new_task->limits.cpus = NULL;
+  new_task->in_queue_cgroup = false;
   new_task->next = NULL;
+  new_task->prev = tasks_tail;
+  new_task->pid_next = NULL;
+  // Grow the task number table if the new number does not fit
+  if (task_id >= task_table_size) {
+    unsigned int new_size = (task_table_size == 0) ? MIN_TABLE_SIZE : 2 * task_table_size;
+    Task** new_table = (Task**)realloc(task_table, new_size * sizeof(Task*));
+    // If error, exit
+    if (new_table == NULL) {
+      exit(1);
+    }
+    memset(new_table + task_table_size, 0, (new_size - task_table_size) * sizeof(Task*));
+    task_table = new_table;
+    task_table_size = new_size;
+  }
+  task_table[task_id] = new_task;
   // And add it to the end of the list
-  if (tasks == NULL) {
+  if (tasks_tail == NULL) {
     tasks = new_task;
   }
-  else {
-    Task* temp = tasks;
-    while (temp->next != NULL) {
-      temp = temp->next;
-    }
-    temp->next = new_task;
+  else {
+    tasks_tail->next = new_task;
+  }
+  tasks_tail = new_task;
+  // Log the event and update the counters
+  log_hiy_task_init(task_id, cmd);
+  task_id++;
+  task_number++;
+}
+
+// Function get_task - searches for a task in the tasks list
+// Input
+//   unsigned int num - task number
+// Output
+//   pointer to the task if found, NULL if not
+Task* get_task(unsigned int num) {
+  // Task numbers index the table directly
+  if (num >= task_table_size) {
+    return NULL;
+  }
+  return task_table[num];
+}
+
+// Function get_fg_task - searches for a foreground task in the tasks list
+// Input
+//   none
+// Output
+//   pointer to the foreground task if found, NULL if not
+Task* get_fg_task() {
+  Task* temp = tasks;
+  // Iterate through the list and return the task if it matches the number
+  while (temp != NULL) {
+    if (temp->state == STATE_RUN_FG) {
+      return temp;
+    }
+    temp = temp->next;
+  }
+  return NULL;
+}
+
+// Function get_task_by_pid - searches for a task in the tasks list
+// Input
+//   pid_t pid - process id of a task
+// Output
+//   pointer to the task if found, NULL if not
+Task* get_task_by_pid(pid_t pid) {
+  if (pid_table == NULL) {
+    return NULL;
+  }
+  Task* temp = pid_table[pid_bucket(pid)];
+  // Walk the bucket and return the task if it matches the pid
+  while (temp != NULL) {
+    if (temp->pid == pid) {
+      return temp;
+    }
+    temp = temp->pid_next;
+  }
+  return NULL;
+}
+
+// Function delete_task - deletes a task from the global linked list of tasks
+// Input
+//   unsigned int num - task number
+void delete_task(unsigned int num) {
+  // Find the task, if not found log task number error and return
+  Task* task = get_task(num);
+  if (task == NULL) {
+    log_hiy_task_num_error(num);
+    return;
+  }
+  // A queued task is taken out of the queue first
+  if (task->state == STATE_QUEUED) {
+    unqueue_task(task);
+  }
+  // If the task is busy, log status error and return
+  if (is_busy(task->state)) {
+    log_hiy_status_error(task->num, task->state);
+    return;
+  }
+  // Otherwise, unlink it from the list and the tables, free it,
+  // log the removal and update the task number
+  if (task->prev != NULL) {
+    task->prev->next = task->next;
+  }
+  else {
+    tasks = task->next;
+  }
+  if (task->next != NULL) {
+    task->next->prev = task->prev;
+  }
+  else {
+    tasks_tail = task->prev;
+  }
+  task_table[num] = NULL;
+  pid_table_remove(task);
+  free_task(task);
+  log_hiy_delete(num);
+  task_number--;
+}
+
+// Function elapsed - seconds between two times
+// Input
+//   struct timespec* from - earlier time
+//   struct timespec* to - later time
+// Output
+//   seconds elapsed
+double elapsed(struct timespec* from, struct timespec* to) {
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// Function seconds - seconds of a struct timeval
+double seconds(struct timeval* time) {
+  return time->tv_sec + time->tv_usec / 1e6;
+}
+
+// Function task_ended - checks whether the last run of a task is over
+bool task_ended(Task* task) {
+  return (task->state == STATE_FINISHED) || (task->state == STATE_KILLED);
+}
+
+// Function task_wall - wall time of the last run of a started task,
+//                      so far if it still runs
+double task_wall(Task* task) {
+  struct timespec now;
+  if (task_ended(task)) {
+    return elapsed(&task->started, &task->ended);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return elapsed(&task->started, &now);
+}
+
+// Function log_task_list - logs the list of tasks
+void log_task_list() {
+  Task* temp = tasks;
+  // Iterate through the linked list and log each task info,
+  // and the resources used by the last run of started tasks.
+  // The rusage of a process is only known once it is reaped.
+  if ((queue_limits.cpu_max != 0) || (queue_limits.memory_max != 0) || (queue_limits.cpus != NULL)) {
+    log_hiy_limits(LIMIT_QUEUE, queue_limits.cpu_max, queue_limits.memory_max, queue_limits.cpus);
+  }
+  while (temp != NULL) {
+    log_hiy_task_info(temp->num, temp->cmd, temp->state, temp->pid, temp->exit_code);
+    if ((temp->limits.cpu_max != 0) || (temp->limits.memory_max != 0) || (temp->limits.cpus != NULL)) {
+      log_hiy_limits(temp->num, temp->limits.cpu_max, temp->limits.memory_max, temp->limits.cpus);
+    }
+    if (temp->pid != 0) {
+      if (task_ended(temp)) {
+        log_hiy_task_usage(temp->num, task_wall(temp), seconds(&temp->usage.ru_utime), seconds(&temp->usage.ru_stime),
+                           temp->usage.ru_maxrss, temp->usage.ru_nvcsw, temp->usage.ru_nivcsw, temp->cg_cpu_usec, temp->cg_memory_peak);
+      }
+      else {
+        log_hiy_task_usage(temp->num, task_wall(temp), -1, -1, -1, -1, -1, -1, -1);
+      }
+    }
+    temp = temp->next;
+  }
+}
+
+// Function dump_tasks - writes the tasks and the resources used by their
+//                       last run as tab-separated values, one task per line
+// Input
+//   char* file - file to write, NULL for the standard output
+void dump_tasks(char* file) {
+  FILE* out = stdout;
+  if (file != NULL) {
+    out = fopen(file, "w");
+    if (out == NULL) {
+      log_hiy_file_error(0, file);
+      return;
+    }
+  }
+  fprintf(out, "task\tpid\tstate\texit_code\twall_s\tuser_s\tsys_s\tmax_rss_kb\tvol_ctx_switches\tinvol_ctx_switches\tcgroup_cpu_usec\tcgroup_memory_peak\tcommand\n");
+  for (Task* temp = tasks; temp != NULL; temp = temp->next) {
+    // Unknown values are left empty
+    fprintf(out, "%u\t%d\t%s\t%d\t", temp->num, temp->pid, log_hiy_state_name(temp->state), temp->exit_code);
+    if (temp->pid != 0) {
+      fprintf(out, "%.6f", task_wall(temp));
+    }
+    if (task_ended(temp)) {
+      fprintf(out, "\t%.6f\t%.6f\t%ld\t%ld\t%ld\t", seconds(&temp->usage.ru_utime), seconds(&temp->usage.ru_stime),
+              temp->usage.ru_maxrss, temp->usage.ru_nvcsw, temp->usage.ru_nivcsw);
+    }
+    else {
+      fprintf(out, "\t\t\t\t\t\t");
+    }
+    if (temp->cg_cpu_usec >= 0) {
+      fprintf(out, "%lld", temp->cg_cpu_usec);
+    }
+    fprintf(out, "\t");
+    if (temp->cg_memory_peak >= 0) {
+      fprintf(out, "%lld", temp->cg_memory_peak);
+    }
+    fprintf(out, "\t%s\n", temp->cmd);
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  else {
+    fflush(stdout);
+  }
+}
+
+// Function relay_close_out - closes the pipe to one consumer of a relay
+// Input
+//   Relay* relay - relay of the consumer
+//   int i - index of the consumer
+void relay_close_out(Relay* relay, int i) {
+  if (relay->outs[i] != -1) {
+    close(relay->outs[i]);
+    relay->outs[i] = -1;
+  }
+}
+
+// Function relay_flush - writes the pending chunk to the consumers that
+//                        have not taken all of it yet
+// Input
+//   Relay* relay - relay to flush
+// Output
+//   true if every consumer is up to date, false if some would block
+bool relay_flush(Relay* relay) {
+  bool done = true;
+  for (int i = 0; i < relay->num_outs; i++) {
+    if ((relay->outs[i] == -1) || (relay->sent[i] >= relay->chunk_length)) {
+      continue;
+    }
+    ssize_t count = write(relay->outs[i], relay->chunk + relay->sent[i], relay->chunk_length - relay->sent[i]);
+    if (count > 0) {
+      relay->sent[i] += count;
+    }
+    // If the consumer is gone, stop feeding it
+    else if ((errno != EAGAIN) && (errno != EINTR)) {
+      relay_close_out(relay, i);
+      continue;
+    }
+    if (relay->sent[i] < relay->chunk_length) {
+      done = false;
+    }
+  }
+  if (done) {
+    relay->chunk_length = 0;
+  }
+  return done;
+}
+
+// Function relay_move - moves the data waiting in the producer's pipe to the
+//                       consumers. The data is duplicated into the consumers'
+//                       pipes with tee and moved into the last one with splice,
+//                       so it is not copied through user space. Only bytes a
+//                       consumer cannot take right away are read into the
+//                       chunk, to be written once it can.
+// Input
+//   Relay* relay - relay to move data through, its chunk must be empty
+//   short revents - poll events of the producer's pipe
+// Output
+//   false once the producer's pipe reached its end, true otherwise
+bool relay_move(Relay* relay, short revents) {
+  int available = 0;
+  ioctl(relay->in, FIONREAD, &available);
+  // If there is nothing to read, the pipe is at its end if the producer hung up
+  if (available <= 0) {
+    return !(revents & (POLLHUP | POLLERR));
+  }
+  size_t length = (available < RELAY_CHUNK) ? available : RELAY_CHUNK;
+  // The last open consumer gets the data spliced, the others a tee of it
+  int last = -1;
+  for (int i = 0; i < relay->num_outs; i++) {
+    if (relay->outs[i] != -1) {
+      last = i;
+    }
+  }
+  if (last == -1) {
+    return false;
+  }
+  bool partial = false;
+  for (int i = 0; i < last; i++) {
+    relay->sent[i] = length;
+    if (relay->outs[i] == -1) {
+      continue;
+    }
+    ssize_t count = tee(relay->in, relay->outs[i], length, SPLICE_F_NONBLOCK);
+    if ((count < 0) && (errno != EAGAIN)) {
+      relay_close_out(relay, i);
+    }
+    // A tee cannot resume where it stopped, the rest comes from the chunk
+    else if (count < (ssize_t)length) {
+      relay->sent[i] = (count > 0) ? count : 0;
+      partial = true;
+    }
+  }
+  // If every tee was complete, the data can be spliced to the last consumer
+  size_t moved = 0;
+  if (!partial) {
+    ssize_t count = splice(relay->in, NULL, relay->outs[last], NULL, length, SPLICE_F_NONBLOCK);
+    if (count > 0) {
+      moved = count;
+    }
+    else if ((count < 0) && (errno != EAGAIN)) {
+      relay_close_out(relay, last);
+    }
+  }
+  // Read the bytes that were not spliced into the chunk, and write them to
+  // every consumer still missing some
+  relay->chunk_length = 0;
+  while (relay->chunk_length < length - moved) {
+    ssize_t count = read(relay->in, relay->chunk + relay->chunk_length, length - moved - relay->chunk_length);
+    if ((count < 0) && (errno == EINTR)) {
+      continue;
+    }
+    else if (count <= 0) {
+      break;
+    }
+    relay->chunk_length += count;
+  }
+  for (int i = 0; i < last; i++) {
+    relay->sent[i] = (relay->sent[i] > moved) ? relay->sent[i] - moved : 0;
+  }
+  relay->sent[last] = 0;
+  relay_flush(relay);
+  return true;
+}
+
+// Function relay_service - lets a relay make progress after a poll
+// Input
+//   Relay* relay - relay to service
+//   bool in_ready - the producer's pipe was polled and has events
+//   short revents - poll events of the producer's pipe
+// Output
+//   false once the relay is finished, true otherwise
+bool relay_service(Relay* relay, bool in_ready, short revents) {
+  // First deliver what is still pending, nothing new is taken until then
+  if ((relay->chunk_length > 0) && !relay_flush(relay)) {
+    return true;
+  }
+  if (in_ready && !relay_move(relay, revents)) {
+    return false;
+  }
+  // Finished if all the consumers are gone
+  for (int i = 0; i < relay->num_outs; i++) {
+    if (relay->outs[i] != -1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Function relay_free - closes the pipes of a relay and frees it
+// Input
+//   Relay* relay - relay to free
+void relay_free(Relay* relay) {
+  if (relay->in != -1) {
+    close(relay->in);
+  }
+  for (int i = 0; i < relay->num_outs; i++) {
+    relay_close_out(relay, i);
+  }
+  free(relay->chunk);
+  free(relay);
+}
+
+// Function relay_fds - counts the descriptors a relay waits on
+// Input
+//   Relay* relay - relay to count for
+// Output
+//   number of descriptors
+int relay_fds(Relay* relay) {
+  // While a chunk is pending, wait for the consumers missing some of it,
+  // otherwise for the producer
+  if (relay->chunk_length == 0) {
+    return 1;
+  }
+  int count = 0;
+  for (int i = 0; i < relay->num_outs; i++) {
+    if ((relay->outs[i] != -1) && (relay->sent[i] < relay->chunk_length)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Function wait_events - sleeps until a signal is queued, a relay can move
+//                        data or, if asked, there is input, and handles the
+//                        signals and the relays that are ready
+// Input
+//   bool* input_ready - set to whether the standard input is readable,
+//                       NULL to not wait for input
+//   int timeout - most milliseconds to sleep, -1 for no limit
+// Output
+//   number of signals handled
+int wait_events(bool* input_ready, int timeout) {
+  // Collect the descriptors: the signals, the input, then the relays in order
+  int num_fds = 2;
+  for (Relay* relay = relays; relay != NULL; relay = relay->next) {
+    num_fds += relay_fds(relay);
+  }
+  struct pollfd fds[num_fds];
+  fds[0] = (struct pollfd){sig_fd, POLLIN, 0};
+  // A negative descriptor is skipped by poll
+  fds[1] = (struct pollfd){(input_ready != NULL) ? STDIN_FILENO : -1, POLLIN, 0};
+  int n = 2;
+  for (Relay* relay = relays; relay != NULL; relay = relay->next) {
+    if (relay->chunk_length == 0) {
+      fds[n++] = (struct pollfd){relay->in, POLLIN, 0};
+      continue;
+    }
+    for (int i = 0; i < relay->num_outs; i++) {
+      if ((relay->outs[i] != -1) && (relay->sent[i] < relay->chunk_length)) {
+        fds[n++] = (struct pollfd){relay->outs[i], POLLOUT, 0};
+      }
+    }
+  }
+  if (input_ready != NULL) {
+    *input_ready = false;
+  }
+  // Write out the buffered logs before going to sleep
+  if (timeout != 0) {
+    log_hiy_flush();
+  }
+  if (poll(fds, num_fds, timeout) <= 0) {
+    return 0;
+  }
+  // Service the relays whose descriptors have events, and free the finished ones
+  n = 2;
+  Relay** link = &relays;
+  while (*link != NULL) {
+    Relay* relay = *link;
+    bool waiting_in = (relay->chunk_length == 0);
+    short revents = 0;
+    for (int count = relay_fds(relay); count > 0; count--) {
+      revents |= fds[n++].revents;
+    }
+    if ((revents != 0) && !relay_service(relay, waiting_in, revents)) {
+      *link = relay->next;
+      relay_free(relay);
+      continue;
+    }
+    link = &relay->next;
+  }
+  if (input_ready != NULL) {
+    *input_ready = (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+  }
+  // Then handle the queued signals
+  if (fds[0].revents & POLLIN) {
+    return handle_signals();
+  }
+  return 0;
+}
+
+// Function wait_fg - waits for a foreground task to leave the foreground
+// Input
+//   Task* task - foreground task to wait for
+void wait_fg(Task* task) {
+  // Sleep until something happens, then recheck the flag updated by the handlers
+  while (task->is_fg) {
+    wait_events(NULL, -1);
+  }
+}
+
+// Function task_redirect - opens a redirection file for a task
+// Input
+//   unsigned int num - task number
+//   char* file - name of the file, NULL if no redirection required
+//   int redir_type - LOG_REDIR_IN or LOG_REDIR_OUT
+//   int* fd - set to the opened descriptor, to close once the task is spawned
+// Output
+//   true if opened (or nothing to redirect), false if the file cannot be opened
+bool task_redirect(unsigned int num, char* file, int redir_type, int* fd) {
+  *fd = -1;
+  if (file == NULL) {
+    return true;
+  }
+  // Open the input for reading, and create or overwrite the output.
+  // The descriptor is close-on-exec, only its duplicate reaches the task.
+  if (redir_type == LOG_REDIR_IN) {
+    *fd = open(file, O_RDONLY | O_CLOEXEC);
+  }
+  else {
+    *fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  }
+  // If it cannot be opened, log an error
+  if (*fd == -1) {
+    log_hiy_file_error(num, file);
+    return false;
+  }
+  // Otherwise, log the redirection
+  log_hiy_redir(num, redir_type, file);
+  return true;
+}
+
+// Function task_resolve - finds the program of a task on the task paths
+// Input
+//   Task* task - task to resolve, its path is set if found
+// Output
+//   true if found, false if not
+bool task_resolve(Task* task) {
+  int length;
+  // Iterate through all the paths, append the program name
+  // to each path and check whether it can be executed
+  for (int i = 0; i < NUM_PATHS; i++) {
+    length = strlen(task_path[i]) + strlen(task->argv[0]) + 1;
+    char path[length];
+    strcpy(path, task_path[i]);
+    strncat(path, task->argv[0], length - strlen(task_path[i]) - 1);
+    if (access(path, X_OK) == 0) {
+      task->path = string_copy(path);
+      return task->path != NULL;
+    }
+  }
+  return false;
+}
+
+// Function spawn_process - spawns a program in a process group, with the
+//                          signal mask and SIGPIPE action hiy started with
+// Input
+//   const char* path - program path
+//   char** argv - program arguments
+//   int in_fd - descriptor to use as the standard input, -1 to keep hiy's
+//   int out_fd - descriptor to use as the standard output, -1 to keep hiy's
+//   pid_t pgid - process group to join, 0 for a new group
+//   int cgroup_dir - cgroup directory to start the process in, -1 for hiy's
+// Output
+//   process id, or -1 if the program cannot be started
+pid_t spawn_process(const char* path, char** argv, int in_fd, int out_fd, pid_t pgid, int cgroup_dir) {
+  pid_t pid = -1;
+  // Without a cgroup, posix_spawn starts the process without copying hiy's
+  // page tables. The descriptors are close-on-exec, only their duplicates
+  // reach the program.
+  if (cgroup_dir == -1) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t default_sigs;
+    sigemptyset(&default_sigs);
+    sigaddset(&default_sigs, SIGPIPE);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigmask(&attr, &old_mask);
+    posix_spawnattr_setsigdefault(&attr, &default_sigs);
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd != -1) {
+      posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1) {
+      posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (posix_spawn(&pid, path, &actions, &attr, argv, environ) != 0) {
+      pid = -1;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+  }
+  // With a cgroup, clone3 starts the process inside it, so all its work is
+  // accounted there. posix_spawn cannot do that, so the child sets itself up
+  // as the spawn attributes would. CLONE_VFORK holds hiy until the exec, so
+  // the process group exists before the next task of a pipe joins it.
+  // A failed exec sends its errno back through a close-on-exec pipe, so it
+  // is reported like a failed posix_spawn rather than as an exit code 127.
+  int exec_error[2];
+  int error = 0;
+  if (pipe2(exec_error, O_CLOEXEC) == -1) {
+    return -1;
+  }
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_INTO_CGROUP | CLONE_VFORK;
+  args.exit_signal = SIGCHLD;
+  args.cgroup = cgroup_dir;
+  pid = syscall(SYS_clone3, &args, sizeof(args));
+  if (pid == 0) {
+    setpgid(0, pgid);
+    if (in_fd != -1) {
+      dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1) {
+      dup2(out_fd, STDOUT_FILENO);
+    }
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    execv(path, argv);
+    error = errno;
+    write(exec_error[1], &error, sizeof(error));
+    _exit(127);
+  }
+  close(exec_error[1]);
+  // The pipe is closed by the exec, or holds the errno once the child is
+  // gone, CLONE_VFORK has held hiy until then. Reap such a child here.
+  if ((pid > 0) && (read(exec_error[0], &error, sizeof(error)) == sizeof(error))) {
+    waitpid(pid, NULL, 0);
+    errno = error;
+    pid = -1;
+  }
+  close(exec_error[0]);
+  return pid;
+}
+
+// Function task_spawn - spawns the process of a task
+// Input
+//   Task* task - task to spawn
+//   int in_fd, int out_fd, pid_t pgid, int cgroup_dir - see spawn_process
+// Output
+//   process id, or -1 if the program cannot be started
+pid_t task_spawn(Task* task, int in_fd, int out_fd, pid_t pgid, int cgroup_dir) {
+  pid_t pid;
+  // The program is looked up on the first start only, later starts reuse the path
+  if ((task->path == NULL) && !task_resolve(task)) {
+    return -1;
+  }
+  pid = spawn_process(task->path, task->argv, in_fd, out_fd, pgid, cgroup_dir);
+  if (pid > 0) {
+    return pid;
+  }
+  // The program may have moved since, so look it up again and retry once
+  free(task->path);
+  task->path = NULL;
+  if (task_resolve(task)) {
+    return spawn_process(task->path, task->argv, in_fd, out_fd, pgid, cgroup_dir);
+  }
+  return -1;
+}
+
+// Function task_cgroup_name - writes the name of a task's cgroup
+// Input
+//   Task* task - task
+//   const char* file - file in the cgroup, NULL for the cgroup itself
+//   char* name - set to the name, relative to cgroup_fd
+//   size_t size - size of name
+void task_cgroup_name(Task* task, const char* file, char* name, size_t size) {
+  // Tasks started from the queue share the limits of its cgroup
+  const char* parent = task->in_queue_cgroup ? CGROUP_QUEUE "/" : "";
+  if (file == NULL) {
+    snprintf(name, size, "%stask-%u", parent, task->num);
+  }
+  else {
+    snprintf(name, size, "%stask-%u/%s", parent, task->num, file);
+  }
+}
+
+// Function write_cgroup_file - writes a value to a cgroup file
+// Input
+//   int dir - cgroup directory
+//   const char* file - file in the cgroup
+//   const char* value - value to write
+// Output
+//   true if written, false if not
+bool write_cgroup_file(int dir, const char* file, const char* value) {
+  int fd = openat(dir, file, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  bool written = (write(fd, value, strlen(value)) == (ssize_t)strlen(value));
+  close(fd);
+  return written;
+}
+
+// Function write_limit - writes one limit to a cgroup file
+// Input
+//   int dir - cgroup directory
+//   const char* file - file in the cgroup
+//   const char* value - value to write
+//   bool unlimited - the value lifts the limit
+//   int num - task number for the error, 0 for the queue
+// Output
+//   true if written, or if the value lifts the limit and its controller is
+//   not enabled, so there is no limit anyway; false (with the error logged)
+//   otherwise
+bool write_limit(int dir, const char* file, const char* value, bool unlimited, int num) {
+  if (write_cgroup_file(dir, file, value) || (unlimited && (errno == ENOENT))) {
+    return true;
+  }
+  log_hiy_limit_error(num, file);
+  return false;
+}
+
+// Function apply_limits - writes resource limits to a cgroup
+// Input
+//   int dir - cgroup directory
+//   Limits* limits - limits to write, the ones not set are lifted
+//   int num - task number for errors, 0 for the queue
+// Output
+//   true if all were written, false (with the error logged) if not
+bool apply_limits(int dir, Limits* limits, int num) {
+  char value[CGROUP_NAME_SIZE];
+  // The CPU limit is a quota of microseconds per period
+  if (limits->cpu_max != 0) {
+    snprintf(value, sizeof(value), "%lld %d", (long long)limits->cpu_max * CPU_PERIOD / 100, CPU_PERIOD);
+  }
+  else {
+    snprintf(value, sizeof(value), "max %d", CPU_PERIOD);
+  }
+  if (!write_limit(dir, "cpu.max", value, limits->cpu_max == 0, num)) {
+    return false;
+  }
+  if (limits->memory_max != 0) {
+    snprintf(value, sizeof(value), "%lld", limits->memory_max);
+  }
+  else {
+    strcpy(value, "max");
+  }
+  if (!write_limit(dir, "memory.max", value, limits->memory_max == 0, num)) {
+    return false;
+  }
+  // An empty list runs on the CPUs of the parent
+  return write_limit(dir, "cpuset.cpus", (limits->cpus != NULL) ? limits->cpus : "", limits->cpus == NULL, num);
+}
+
+// Function enable_controllers - lets the children of a cgroup be limited
+//                               in CPU, memory and CPU placement
+// Input
+//   int dir - cgroup directory
+void enable_controllers(int dir) {
+  // Each controller is enabled on its own, so one that is not
+  // available does not keep the others from being enabled
+  write_cgroup_file(dir, "cgroup.subtree_control", "+cpu");
+  write_cgroup_file(dir, "cgroup.subtree_control", "+memory");
+  write_cgroup_file(dir, "cgroup.subtree_control", "+cpuset");
+}
+
+// Function open_cgroups - sets up the --cgroup directory and the queue's cgroup in it
+// Input
+//   const char* dir - the --cgroup directory
+// Output
+//   true if set up, false if not
+bool open_cgroups(const char* dir) {
+  cgroup_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (cgroup_fd == -1) {
+    return false;
+  }
+  enable_controllers(cgroup_fd);
+  if ((mkdirat(cgroup_fd, CGROUP_QUEUE, 0755) == -1) && (errno != EEXIST)) {
+    return false;
+  }
+  queue_cgroup_fd = openat(cgroup_fd, CGROUP_QUEUE, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (queue_cgroup_fd == -1) {
+    return false;
+  }
+  enable_controllers(queue_cgroup_fd);
+  return true;
+}
+
+// Function task_cgroup_open - creates the cgroup of a task under the --cgroup
+//                             directory, or reuses it if it is still there,
+//                             and sets the task's limits on it
+// Input
+//   Task* task - task
+// Output
+//   descriptor of the cgroup directory, -1 if cgroups are not used or on
+//   error (with the error logged)
+int task_cgroup_open(Task* task) {
+  char name[CGROUP_NAME_SIZE];
+  if (cgroup_fd == -1) {
+    return -1;
+  }
+  task_cgroup_name(task, NULL, name, sizeof(name));
+  if ((mkdirat(cgroup_fd, name, 0755) == -1) && (errno != EEXIST)) {
+    log_hiy_limit_error(task->num, name);
+    return -1;
+  }
+  int dir = openat(cgroup_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir == -1) {
+    log_hiy_limit_error(task->num, name);
+    return -1;
+  }
+  if (!apply_limits(dir, &task->limits, task->num)) {
+    close(dir);
+    unlinkat(cgroup_fd, name, AT_REMOVEDIR);
+    return -1;
+  }
+  return dir;
+}
+
+// Function read_cgroup_value - reads a number from a file of a task's cgroup
+// Input
+//   Task* task - task
+//   const char* file - file in the cgroup
+//   const char* key - key of the value in a flat keyed file, NULL if the
+//                     file holds a single value
+// Output
+//   the value, -1 if it cannot be read
+long long read_cgroup_value(Task* task, const char* file, const char* key) {
+  char name[CGROUP_NAME_SIZE];
+  char text[CGROUP_FILE_SIZE];
+  task_cgroup_name(task, file, name, sizeof(name));
+  int fd = openat(cgroup_fd, name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  ssize_t length = read(fd, text, sizeof(text) - 1);
+  close(fd);
+  if (length <= 0) {
+    return -1;
+  }
+  text[length] = '\0';
+  // Find "key value" at the start of a line
+  char* value = text;
+  if (key != NULL) {
+    size_t key_length = strlen(key);
+    value = NULL;
+    for (char* line = text; line != NULL; line = strchr(line, '\n')) {
+      line += (*line == '\n');
+      if ((strncmp(line, key, key_length) == 0) && (line[key_length] == ' ')) {
+        value = line + key_length + 1;
+        break;
+      }
+    }
+    if (value == NULL) {
+      return -1;
+    }
+  }
+  return strtoll(value, NULL, 10);
+}
+
+// Function task_cgroup_collect - records the CPU time and peak memory of a
+//                                finished task's cgroup, then removes it
+// Input
+//   Task* task - finished or killed task
+void task_cgroup_collect(Task* task) {
+  char name[CGROUP_NAME_SIZE];
+  if (cgroup_fd == -1) {
+    return;
+  }
+  task->cg_cpu_usec = read_cgroup_value(task, "cpu.stat", "usage_usec");
+  task->cg_memory_peak = read_cgroup_value(task, "memory.peak", NULL);
+  // The removal fails if processes the task left behind still run in it,
+  // the next start of the task reuses the cgroup then
+  task_cgroup_name(task, NULL, name, sizeof(name));
+  unlinkat(cgroup_fd, name, AT_REMOVEDIR);
+}
+
+// Function set_limits - sets the resource limits of a task, applied from its
+//                       next start and at once if it is running, or of the
+//                       queue, shared by all the tasks started from it
+// Input
+//   int num - task number, LIMIT_QUEUE for the queue
+//   int cpu_max, long long memory_max, char* cpus - the limits, see Limits
+void set_limits(int num, int cpu_max, long long memory_max, char* cpus) {
+  Limits limits = {cpu_max, memory_max, cpus};
+  Limits* target = &queue_limits;
+  int dir = queue_cgroup_fd;
+  char name[CGROUP_NAME_SIZE];
+  // Limits are set on cgroups, and read as a whole
+  if (cgroup_fd == -1) {
+    log_hiy_limit_error(num, "limits without --cgroup");
+    return;
+  }
+  if (cpu_max == LIMIT_INVALID) {
+    log_hiy_limit_error(num, "limits");
+    return;
+  }
+  if (num != LIMIT_QUEUE) {
+    // Find the task and report the error if not found
+    Task* task = get_task(num);
+    if (task == NULL) {
+      log_hiy_task_num_error(num);
+      return;
+    }
+    target = &task->limits;
+    dir = -1;
+    // A running task's cgroup takes the new limits at once
+    if (is_busy(task->state) && (task->state != STATE_QUEUED)) {
+      task_cgroup_name(task, NULL, name, sizeof(name));
+      dir = openat(cgroup_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+  }
+  bool applied = (dir == -1) || apply_limits(dir, &limits, num);
+  if ((dir != -1) && (dir != queue_cgroup_fd)) {
+    close(dir);
+  }
+  if (!applied) {
+    return;
+  }
+  // Keep the limits, replacing the old ones
+  free(target->cpus);
+  *target = limits;
+  if (cpus != NULL) {
+    target->cpus = string_copy(cpus);
+  }
+  log_hiy_limits(num, cpu_max, memory_max, cpus);
+}
+
+// Function spawn_task - spawns the process of a task and sets it running
+// Input
+//   Task* task - task to start, must not be busy
+//   char* infile - input file for redirection, NULL if none
+//   char* outfile - output file for redirection, NULL if none
+//   int in_fd - descriptor to use as the standard input, -1 if none
+//   int out_fd - descriptor to use as the standard output, -1 if none
+//   pid_t pgid - process group to join, 0 for a new group
+//   unsigned short new_state - new task state (STATE_RUN_FG or STATE_RUN_BG)
+// Output
+//   process id, or -1 if the task could not be started
+pid_t spawn_task(Task* task, char* infile, char* outfile, int in_fd, int out_fd, pid_t pgid, unsigned short new_state) {
+  int infd = -1;
+  int outfd = -1;
+  int cgroup_dir = -1;
+  char name[CGROUP_NAME_SIZE];
+  pid_t pid = -1;
+  // Open the redirection files, if any, they take the place of the pipe ends
+  if (!task_redirect(task->num, infile, LOG_REDIR_IN, &infd) ||
+      !task_redirect(task->num, outfile, LOG_REDIR_OUT, &outfd)) {
+    goto cleanup;
+  }
+  if (infd != -1) {
+    in_fd = infd;
+  }
+  if (outfd != -1) {
+    out_fd = outfd;
+  }
+  // If cgroups are used, set up the task's own cgroup with its limits,
+  // under the queue's cgroup when started from the queue
+  task->in_queue_cgroup = (task->state == STATE_QUEUED);
+  cgroup_dir = task_cgroup_open(task);
+  if ((cgroup_fd != -1) && (cgroup_dir == -1)) {
+    goto cleanup;
+  }
+  // Spawn the child process in it, if error log it
+  pid = task_spawn(task, in_fd, out_fd, pgid, cgroup_dir);
+  if (pid < 0) {
+    log_hiy_start_error(task->cmd);
+    if (cgroup_dir != -1) {
+      task_cgroup_name(task, NULL, name, sizeof(name));
+      unlinkat(cgroup_fd, name, AT_REMOVEDIR);
+    }
+    goto cleanup;
+  }
+  // Log the status
+  log_hiy_status(task->num, task->cmd, pid, task->state, new_state);
+  // Set the pid, process group, state and reset exit code if needed
+  pid_table_remove(task);
+  task->pid = pid;
+  pid_table_insert(task);
+  task->pgid = (pgid != 0) ? pgid : pid;
+  task->state = new_state;
+  if (task->exit_code != 0) {
+    task->exit_code = 0;
+  }
+  // Set the foreground flag appropriately
+  task->is_fg = (new_state == STATE_RUN_FG);
+  // Start the accounting of this run
+  clock_gettime(CLOCK_MONOTONIC, &task->started);
+  memset(&task->usage, 0, sizeof(task->usage));
+  task->cg_cpu_usec = -1;
+  task->cg_memory_peak = -1;
+
+cleanup:
+  // Close the redirection files and the cgroup, the child is set up
+  if (infd != -1) {
+    close(infd);
+  }
+  if (outfd != -1) {
+    close(outfd);
+  }
+  if (cgroup_dir != -1) {
+    close(cgroup_dir);
+  }
+  return pid;
+}
+
+// Function start_task - starts a task from the tasks list
+// Input
+//   unsigned int num - task number
+//   char* infile - input file for redirection
+//   char* outfile - output file for redirection
+//   unsigned short new_state - new task state (STATE_RUN_FG or STATE_RUN_BG)
+void start_task(unsigned int num, char* infile, char* outfile, unsigned short new_state) {
+  // First, try to find the task
+  Task* task = get_task(num);
+  // Log an error and return if not found
+  if (task == NULL) {
+    log_hiy_task_num_error(num);
+    return;
+  }
+  // If the task is busy, log status error and return
+  if (is_busy(task->state)) {
+    log_hiy_status_error(task->num, task->state);
+    return;
+  }
+  // Else, everything is fine, spawn it and wait for it if it is foreground
+  if (spawn_task(task, infile, outfile, -1, -1, 0, new_state) > 0) {
+    wait_fg(task);
   }
-  // Log the event and update the counters
-  log_hiy_task_init(task_id, cmd);
-  task_id++;
-  task_number++;
 }
 
-// Function delete_task - deletes a task from the global linked list of tasks
+// Function get_stages - finds the tasks of a pipe or tee
 // Input
-//   unsigned int num - task number
-void delete_task(unsigned int num) {
-  // If the list is empty, log task number error and return
-  if (tasks == NULL) {
-    log_hiy_task_num_error(num);
-    return;
+//   int nums[] - task numbers, in order
+//   int count - number of task numbers
+//   Task* stages[] - set to the tasks
+// Output
+//   true if every task exists, appears once and is idle, false (with
+//   the error logged) otherwise
+bool get_stages(int nums[], int count, Task* stages[]) {
+  // A list that was too long or had a bad number is rejected as a whole,
+  // so a partial pipeline never starts
+  if (count == STAGES_INVALID) {
+    log_hiy_stages_error(MAXSTAGES);
+    return false;
   }
-  // If it matches the first element, check the state and remove it if possible
-  if (tasks->num == num) {
-    // If the task is busy, log status error and return
-    if (is_busy(tasks->state)) {
-      log_hiy_status_error(tasks->num, tasks->state);
-      return;
-    }
-    // Otherwise, remove it, update the list head and task number,
-    // and log the removal
-    Task* temp = tasks;
-    tasks = tasks->next;
-    free_task(temp);
-    log_hiy_delete(num);
-    task_number--;
-    return;
+  // A pipe needs at least two tasks, report the missing one
+  if (count < 2) {
+    log_hiy_task_num_error(0);
+    return false;
   }
-  // If it was not the first, we need to iterate through the list
-  Task* temp = tasks;
-  while (temp->next != NULL) {
-    // If the task number matches, check the state and remove it if possible
-    if (temp->next->num == num) {
-      // If the task is busy, log status error and return
-      if (is_busy(temp->next->state)) {
-        log_hiy_status_error(temp->next->num, temp->next->state);
-        return;
+  for (int i = 0; i < count; i++) {
+    // If a task number appears twice, log the error and return
+    for (int j = 0; j < i; j++) {
+      if (nums[j] == nums[i]) {
+        log_hiy_pipe_error(nums[i]);
+        return false;
       }
-      // Otherwise, remove it, update the list pointers and task number,
-      // and log the removal
-      Task* to_delete = temp->next;
-      temp->next = temp->next->next;
-      free_task(to_delete);
-      log_hiy_delete(num);
-      task_number--;
-      return;
     }
-    // If the task number of the next task in the list is higher,
-    // then we know for sure that it is not in the list because
-    // the tasks are always sorted in ascending order by task number
-    else if (temp->next->num > num) {
-      log_hiy_task_num_error(num);
-      return;
+    // Try to find the task, check its state and log errors if needed
+    stages[i] = get_task(nums[i]);
+    if (stages[i] == NULL) {
+      log_hiy_task_num_error(nums[i]);
+      return false;
+    }
+    if (is_busy(stages[i]->state)) {
+      log_hiy_status_error(stages[i]->num, stages[i]->state);
+      return false;
     }
-    temp = temp->next;
   }
-  // If not found in the list, report task number error and return
-  log_hiy_task_num_error(num);
-  return;
+  return true;
 }
 
-// Function get_task - searches for a task in the tasks list
+// Function pipe_tasks - starts a pipeline of tasks, redirecting the output
+//                       of each task to the input of the next one. The tasks
+//                       share one process group, the last runs in foreground.
 // Input
-//   unsigned int num - task number
-// Output
-//   pointer to the task if found, NULL if not
-Task* get_task(unsigned int num) {
-  Task* temp = tasks;
-  // Iterate through the list and return the task if it matches the number
-  while (temp != NULL) {
-    if (temp->num == num) {
-      return temp;
+//   int nums[] - task numbers, in pipeline order
+//   int count - number of tasks
+void pipe_tasks(int nums[], int count) {
+  Task* stages[MAXSTAGES];
+  if (!get_stages(nums, count, stages)) {
+    return;
+  }
+  int in_fd = -1;
+  pid_t pgid = 0;
+  for (int i = 0; i < count; i++) {
+    // Create the pipe to the next task, if any, and log error if failed
+    int pipe_fds[2] = {-1, -1};
+    if (i < count - 1) {
+      if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        log_hiy_file_error(nums[i], LOG_FILE_PIPE);
+        if (in_fd != -1) {
+          close(in_fd);
+        }
+        return;
+      }
+      log_hiy_pipe(nums[i], nums[i + 1]);
     }
-    temp = temp->next;
+    // Start the task, in the process group of the first one
+    pid_t pid = spawn_task(stages[i], NULL, NULL, in_fd, pipe_fds[1], pgid, (i < count - 1) ? STATE_RUN_BG : STATE_RUN_FG);
+    if ((pgid == 0) && (pid > 0)) {
+      pgid = pid;
+    }
+    // The task has its own copies of the pipe ends now
+    if (in_fd != -1) {
+      close(in_fd);
+    }
+    if (pipe_fds[1] != -1) {
+      close(pipe_fds[1]);
+    }
+    in_fd = pipe_fds[0];
   }
-  return NULL;
+  // Wait for the last task, it runs in foreground
+  wait_fg(stages[count - 1]);
 }
 
-// Function get_fg_task - searches for a foreground task in the tasks list
+// Function tee_tasks - starts a task and copies its output to the input of
+//                      each of the other tasks. hiy relays the output with
+//                      tee and splice, see relay_move. The tasks share one
+//                      process group, the last runs in foreground.
 // Input
-//   none
-// Output
-//   pointer to the foreground task if found, NULL if not
-Task* get_fg_task() {
-  Task* temp = tasks;
-  // Iterate through the list and return the task if it matches the number
-  while (temp != NULL) {
-    if (temp->state == STATE_RUN_FG) {
-      return temp;
+//   int nums[] - task numbers, the producer first
+//   int count - number of tasks
+void tee_tasks(int nums[], int count) {
+  Task* stages[MAXSTAGES];
+  if (!get_stages(nums, count, stages)) {
+    return;
+  }
+  Relay* relay = (Relay*)calloc(1, sizeof(Relay));
+  // If error, exit
+  if (relay == NULL) {
+    exit(1);
+  }
+  relay->chunk = (char*)malloc(RELAY_CHUNK);
+  if (relay->chunk == NULL) {
+    exit(1);
+  }
+  relay->in = -1;
+  for (int i = 0; i < MAXSTAGES; i++) {
+    relay->outs[i] = -1;
+  }
+  // Create the pipe from the producer, hiy keeps the read end
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    log_hiy_file_error(nums[0], LOG_FILE_PIPE);
+    relay_free(relay);
+    return;
+  }
+  relay->in = pipe_fds[0];
+  // Start the producer, if failed there is nothing to relay
+  pid_t pgid = spawn_task(stages[0], NULL, NULL, -1, pipe_fds[1], 0, STATE_RUN_BG);
+  close(pipe_fds[1]);
+  if (pgid < 0) {
+    relay_free(relay);
+    return;
+  }
+  // Start the consumers, each reading from its own pipe fed by hiy
+  for (int i = 1; i < count; i++) {
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+      log_hiy_file_error(nums[i], LOG_FILE_PIPE);
+      continue;
     }
-    temp = temp->next;
+    log_hiy_pipe(nums[0], nums[i]);
+    if (spawn_task(stages[i], NULL, NULL, pipe_fds[0], -1, pgid, (i < count - 1) ? STATE_RUN_BG : STATE_RUN_FG) > 0) {
+      relay->outs[relay->num_outs] = pipe_fds[1];
+    }
+    else {
+      close(pipe_fds[1]);
+    }
+    relay->num_outs++;
+    close(pipe_fds[0]);
   }
-  return NULL;
+  // hiy must never block on the relay, only its own ends are non-blocking
+  fcntl(relay->in, F_SETFL, O_NONBLOCK);
+  for (int i = 0; i < relay->num_outs; i++) {
+    if (relay->outs[i] != -1) {
+      fcntl(relay->outs[i], F_SETFL, O_NONBLOCK);
+    }
+  }
+  relay->next = relays;
+  relays = relay;
+  // Wait for the last task, it runs in foreground
+  wait_fg(stages[count - 1]);
 }
 
-// Function get_task_by_pid - searches for a task in the tasks list
+// Function queue_before - orders the queue: higher priority first, then
+//                         first come, first served
 // Input
-//   pid_t pid - process id of a task
+//   Task* a, Task* b - queued tasks
 // Output
-//   pointer to the task if found, NULL if not
-Task* get_task_by_pid(pid_t pid) {
-  Task* temp = tasks;
-  // Iterate through the list and return the task if it matches the number
-  while (temp != NULL) {
-    if (temp->pid == pid) {
-      return temp;
-    }
-    temp = temp->next;
+//   true if a runs before b
+bool queue_before(Task* a, Task* b) {
+  if (a->priority != b->priority) {
+    return a->priority > b->priority;
   }
-  return NULL;
+  return a->queue_seq < b->queue_seq;
 }
 
-// Function log_task_list - logs the list of tasks
-void log_task_list() {
-  Task* temp = tasks;
-  // Iterate through the linked list and log each task info
-  while (temp != NULL) {
-    log_hiy_task_info(temp->num, temp->cmd, temp->state, temp->pid, temp->exit_code);
-    temp = temp->next;
+// Function queue_sift_up - places a task in the queue heap, moving it up
+//                         from a free position
+// Input
+//   unsigned int i - free position
+//   Task* task - task to place
+void queue_sift_up(unsigned int i, Task* task) {
+  while ((i > 0) && queue_before(task, queue[(i - 1) / 2])) {
+    queue[i] = queue[(i - 1) / 2];
+    i = (i - 1) / 2;
   }
+  queue[i] = task;
 }
 
-// Function task_input_redirect - redirects input for a task from the file
+// Function queue_sift_down - places a task in the queue heap, moving it down
+//                           from a free position
 // Input
-//   unsigned int num - task number
-//   char* infile - name of the input file
-void task_input_redirect(unsigned int num, char* infile) {
-  // If the filename is valid, try to open the file and redirect the input
-  if (infile != NULL) {
-    int infd = open(infile, O_RDONLY);
-    // If it cannot be opened, log an error and terminate the child
-    if (infd == -1) {
-      log_hiy_file_error(num, infile);
-      exit(1);
+//   unsigned int i - free position
+//   Task* task - task to place
+void queue_sift_down(unsigned int i, Task* task) {
+  while (true) {
+    unsigned int child = 2 * i + 1;
+    if (child >= queue_length) {
+      break;
     }
-    // Otherwise, redirect the standard input and log the redirection
-    dup2(infd, STDIN_FILENO);
-    close(infd);
-    log_hiy_redir(num, LOG_REDIR_IN, infile);
+    if ((child + 1 < queue_length) && queue_before(queue[child + 1], queue[child])) {
+      child++;
+    }
+    if (!queue_before(queue[child], task)) {
+      break;
+    }
+    queue[i] = queue[child];
+    i = child;
   }
+  queue[i] = task;
 }
 
-// Function task_output_redirect - redirects output for a task to the file
+// Function queue_push - adds a task to the queue heap
 // Input
-//   unsigned int num - task number
-//   char* outfile - name of the output file
-void task_output_redirect(unsigned int num, char* outfile) {
-  // If the filename is valid, try to open the file and redirect the output
-  if (outfile != NULL) {
-    // Create if it does not exist and overwrite if it does
-    int outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-    // If it cannot be opened, log an error and terminate the child
-    if (outfd == -1) {
-      log_hiy_file_error(num, outfile);
+//   Task* task - task to add
+void queue_push(Task* task) {
+  // Grow the heap if it is full
+  if (queue_length == queue_capacity) {
+    unsigned int new_capacity = (queue_capacity == 0) ? MIN_TABLE_SIZE : 2 * queue_capacity;
+    Task** new_queue = (Task**)realloc(queue, new_capacity * sizeof(Task*));
+    // If error, exit
+    if (new_queue == NULL) {
       exit(1);
     }
-    // Otherwise, redirect the standard output and log the redirection
-    dup2(outfd, STDOUT_FILENO);
-    close(outfd);
-    log_hiy_redir(num, LOG_REDIR_OUT, outfile);
+    queue = new_queue;
+    queue_capacity = new_capacity;
   }
+  // Sift the task up from the bottom of the heap
+  queue_sift_up(queue_length++, task);
 }
 
-// Function task_execute - executes a task
-// Input
-//   Task* task - task to execute
-void task_execute(Task* task) {
-  int length;
-  // Iterate through all the paths, append the program name
-  // to each path and try to execute it
-  for (int i = 0; i < NUM_PATHS; i++) {
-    length = strlen(task_path[i]) + strlen(task->argv[0]) + 1;
-    char path[length];
-    strcpy(path, task_path[i]);
-    strncat(path, task->argv[0], length - strlen(task_path[i]) - 1);
-    execv(path, task->argv);
+// Function queue_pop - removes the next task to run from the queue heap
+// Output
+//   the task, NULL if the queue is empty
+Task* queue_pop() {
+  if (queue_length == 0) {
+    return NULL;
+  }
+  Task* next = queue[0];
+  Task* last = queue[--queue_length];
+  // Sift the last task down from the top of the heap
+  if (queue_length > 0) {
+    queue_sift_down(0, last);
   }
-  // If execv returned, it must be an error, report it and exit
-  log_hiy_start_error(task->cmd);
-  exit(1);
+  return next;
 }
 
-// Function start_task - starts a task from the tasks list
+// Function queue_remove - takes a task out of the queue heap, to cancel it
 // Input
-//   unsigned int num - task number
-//   char* infile - input file for redirection
-//   char* outfile - output file for redirection
-//   unsigned short new_state - new task state (STATE_RUN_FG or STATE_RUN_BG)
-//   int pipe_fds[] - pipe file descriptors, NULL if no piping required
-void start_task(unsigned int num, char* infile, char* outfile, unsigned short new_state, int pipe_fds[]) {
-  // First, try to find the task
-  Task* task = get_task(num);
-  // Log an error and return if not found
-  if (task == NULL) {
-    log_hiy_task_num_error(num);
+//   Task* task - queued task
+void queue_remove(Task* task) {
+  unsigned int i = 0;
+  while ((i < queue_length) && (queue[i] != task)) {
+    i++;
+  }
+  if (i == queue_length) {
     return;
   }
-  // If the task is busy, log status error and return
-  if (is_busy(task->state)) {
-    log_hiy_status_error(task->num, task->state);
+  // Fill the hole with the last task, which may belong above or below it
+  Task* last = queue[--queue_length];
+  if (i == queue_length) {
     return;
   }
-  // Block the signals
-  sigprocmask(SIG_BLOCK, &mask, &old_mask);
-  // Else, everything is fine, fork a child process
-  pid_t pid = fork();
-  // If fork error, just exit
-  if (pid < 0) {
-    exit(1);
+  if ((i > 0) && queue_before(last, queue[(i - 1) / 2])) {
+    queue_sift_up(i, last);
   }
-  // Child process
-  else if (pid == 0) {
-    // Give the child a new process group id
-    setpgid(0, 0);
-    // Redirect the input, check if it should be connected to the pipe
-    if (pipe_fds != NULL) {
-      if (new_state == STATE_RUN_FG) {
-        dup2(pipe_fds[0], STDIN_FILENO);
-        close(pipe_fds[1]);
-      }
-    }
-    else {
-      task_input_redirect(num, infile);
+  else {
+    queue_sift_down(i, last);
+  }
+}
+
+// Function unqueue_task - cancels a queued task, returning it to Ready
+// Input
+//   Task* task - queued task
+void unqueue_task(Task* task) {
+  queue_remove(task);
+  task->state = STATE_READY;
+  log_hiy_unqueue(task->num, task->cmd);
+}
+
+// Function schedule_tasks - starts queued tasks in the background while
+//                           there are free slots
+void schedule_tasks() {
+  while (slots_used < max_slots) {
+    Task* task = queue_pop();
+    if (task == NULL) {
+      return;
     }
-    // Redirect the output, check if it should be connected to the pipe
-    if (pipe_fds != NULL) {
-      if (new_state == STATE_RUN_BG) {
-        dup2(pipe_fds[1], STDOUT_FILENO);
-        close(pipe_fds[0]);
-      }
+    // The task holds its slot until it finishes or is killed
+    if (spawn_task(task, NULL, NULL, -1, -1, 0, STATE_RUN_BG) > 0) {
+      task->holds_slot = true;
+      slots_used++;
     }
     else {
-      task_output_redirect(num, outfile);
+      task->state = STATE_READY;
     }
-    // Unblock the signals
-    sigprocmask(SIG_SETMASK, &old_mask, NULL);
-    // Execute the task command
-    task_execute(task);
-  }
-  // Close the pipe ends if there are any open ones, and if this process is fg
-  if ((pipe_fds != NULL) && (new_state == STATE_RUN_FG)) {
-    close(pipe_fds[0]);
-    close(pipe_fds[1]);
-  }
-  // In parent process, first log the status
-  log_hiy_status(num, task->cmd, pid, task->state, new_state);
-  // Set the pid, state and reset exit code if needed
-  task->pid = pid;
-  task->state = new_state;
-  if (task->exit_code != 0) {
-    task->exit_code = 0;
-  }
-  // Set the foreground flag appropriately
-  task->is_fg = (new_state == STATE_RUN_FG);
-  // Unblock the signals
-  sigprocmask(SIG_SETMASK, &old_mask, NULL);
-  // Wait for the process to end if it is foreground
-  while (task->state == STATE_RUN_FG);
-}
-
-// Function pipe_tasks - starts two tasks, redirecting the output of the
-//                       first to the input of the second task
-// Input
-//   unsigned int num1 - task 1 number
-//   unsigned int num2 - task 2 number
-void pipe_tasks(unsigned int num1, unsigned int num2) {
-  Task* task1;
-  Task* task2;
-  // If the two task numbers are identical, log the error and return
-  if (num1 == num2) {
-    log_hiy_pipe_error(num1);
-    return;
-  }
-  // Try to find the first task, check its state and log errors if needed
-  task1 = get_task(num1);
-  if (task1 == NULL) {
-    log_hiy_task_num_error(num1);
-    return;
-  }
-  if (is_busy(task1->state)) {
-    log_hiy_status_error(task1->num, task1->state);
-    return;
   }
-  // Try to find the second task, check its state and log errors if needed
-  task2 = get_task(num2);
-  if (task2 == NULL) {
-    log_hiy_task_num_error(num2);
+}
+
+// Function queue_task - queues a task to run in the background once a slot
+//                       is free
+// Input
+//   unsigned int num - task number
+//   int priority - tasks with a higher priority start first
+void queue_task(unsigned int num, int priority) {
+  // First, try to find the task and report the error if not found
+  Task* task = get_task(num);
+  if (task == NULL) {
+    log_hiy_task_num_error(num);
     return;
   }
-  if (is_busy(task2->state)) {
-    log_hiy_status_error(task2->num, task2->state);
+  // If the task is busy (or already queued), log status error and return
+  if (is_busy(task->state)) {
+    log_hiy_status_error(task->num, task->state);
     return;
   }
+  // Else, queue it, log the event and start it if there is a free slot
+  task->priority = priority;
+  task->queue_seq = queue_arrivals++;
+  task->state = STATE_QUEUED;
+  queue_push(task);
+  log_hiy_queue(num, task->cmd, priority);
+  schedule_tasks();
+}
 
-  // If everything passed, try to create a pipe and log error if failed
-  int pipe_fds[2];
-  if (pipe(pipe_fds) == -1) {
-    log_hiy_file_error(num1, LOG_FILE_PIPE);
-    return;
+// Function drain_queue - waits until every queued task has run and
+//                        given its slot back
+void drain_queue() {
+  while ((queue_length > 0) || (slots_used > 0)) {
+    wait_events(NULL, -1);
   }
-
-  // If passed, log the successful pipe creation
-  log_hiy_pipe(num1, num2);
-
-  // Start the first process in background
-  start_task(num1, NULL, NULL, STATE_RUN_BG, pipe_fds);
-  // Start the second process in foreground
-  start_task(num2, NULL, NULL, STATE_RUN_FG, pipe_fds);
 }
 
 // Function run_fg - runs a task in the foreground
@@ -417,7 +1584,7 @@ void run_fg(unsigned int num) {
   }
   // If the task is idle (not busy), just call start function
   if (!is_busy(task->state)) {
-    start_task(num, NULL, NULL, STATE_RUN_FG, NULL);
+    start_task(num, NULL, NULL, STATE_RUN_FG);
   }
   // Else, if the task is suspended, send a signal to wake it up
   else if (task->state == STATE_SUSPENDED) {
@@ -426,7 +1593,7 @@ void run_fg(unsigned int num) {
     kill(task->pid, SIGCONT);
     log_hiy_sig_sent(LOG_CMD_RESUME, num, task->pid);
     // Wait for the process to finish (signal handler will update the flag)
-    while (task->is_fg);
+    wait_fg(task);
   }
   // Else, if the task is running in background, switch it to foreground
   else if (task->state == STATE_RUN_BG) {
@@ -434,11 +1601,11 @@ void run_fg(unsigned int num) {
     task->is_fg = true;
     log_hiy_status(num, task->cmd, task->pid, STATE_RUN_BG, STATE_RUN_FG);
     // Wait for the process to finish (signal handler will update the flag)
-    while (task->is_fg);
+    wait_fg(task);
   }
-  // Else, if the task is running in foreground, report error
-  else if (task->state == STATE_RUN_FG) {
-    log_hiy_status_error(num, STATE_RUN_FG);
+  // Else, if the task is running in foreground or queued, report error
+  else if ((task->state == STATE_RUN_FG) || (task->state == STATE_QUEUED)) {
+    log_hiy_status_error(num, task->state);
   }
 }
 
@@ -454,7 +1621,7 @@ void run_bg(unsigned int num) {
   }
   // If the task is idle (not busy), just call start function
   if (!is_busy(task->state)) {
-    start_task(num, NULL, NULL, STATE_RUN_BG, NULL);
+    start_task(num, NULL, NULL, STATE_RUN_BG);
   }
   // Else, if the task is suspended, send a signal to wake it up
   else if (task->state == STATE_SUSPENDED) {
@@ -467,9 +1634,9 @@ void run_bg(unsigned int num) {
   else if (task->state == STATE_RUN_BG) {
     log_hiy_status_error(num, STATE_RUN_BG);
   }
-  // Else, if the task is running in foreground, report error
-  else if (task->state == STATE_RUN_FG) {
-    log_hiy_status_error(num, STATE_RUN_FG);
+  // Else, if the task is running in foreground or queued, report error
+  else if ((task->state == STATE_RUN_FG) || (task->state == STATE_QUEUED)) {
+    log_hiy_status_error(num, task->state);
   }
 }
 
@@ -483,6 +1650,11 @@ void kill_task(unsigned int num) {
     log_hiy_task_num_error(num);
     return;
   }
+  // A queued task has no process yet, so it is cancelled instead
+  if (task->state == STATE_QUEUED) {
+    unqueue_task(task);
+    return;
+  }
   // If the task is not running, report error
   if ((task->state != STATE_RUN_FG) && (task->state != STATE_RUN_BG)) {
     log_hiy_status_error(num, task->state);
@@ -503,8 +1675,8 @@ void suspend_task(unsigned int num) {
     log_hiy_task_num_error(num);
     return;
   }
-  // If the task is idle (not busy), report error
-  if (!is_busy(task->state)) {
+  // If the task is idle (not busy) or has not started yet, report error
+  if (!is_busy(task->state) || (task->state == STATE_QUEUED)) {
     log_hiy_status_error(num, task->state);
     return;
   }
@@ -514,39 +1686,33 @@ void suspend_task(unsigned int num) {
 }
 
 // Function handle_sigint - handles the SIGINT signal
-// Input
-//   int sig - signal code
-void handle_sigint(int sig) {
+void handle_sigint() {
   // Log the signal event
   log_hiy_ctrl_c();
   // Try to find the foreground task
   Task* fg_task = get_fg_task();
-  // If found, pass the SIGINT signal to it
+  // If found, pass the SIGINT signal to it and the tasks piped with it
   if (fg_task != NULL) {
-    kill(fg_task->pid, SIGINT);
+    kill(-fg_task->pgid, SIGINT);
     log_hiy_sig_sent(LOG_CMD_KILL, fg_task->num, fg_task->pid);
   }
 }
 
 // Function handle_sigtstp - handles the SIGTSTP signal
-// Input
-//   int sig - signal code
-void handle_sigtstp(int sig) {
+void handle_sigtstp() {
   // Log the signal event
   log_hiy_ctrl_z();
   // Try to find the foreground task
   Task* fg_task = get_fg_task();
-  // If found, pass the SIGTSTP signal to it
+  // If found, pass the SIGTSTP signal to it and the tasks piped with it
   if (fg_task != NULL) {
-    kill(fg_task->pid, SIGTSTP);
+    kill(-fg_task->pgid, SIGTSTP);
     log_hiy_sig_sent(LOG_CMD_SUSPEND, fg_task->num, fg_task->pid);
   }
 }
 
 // Function handle_sigquit - handles the SIGQUIT signal
-// Input
-//   int sig - signal code
-void handle_sigquit(int sig) {
+void handle_sigquit() {
   // Log the signal event
   log_hiy_ctrl_bs();
   // Try to find the foreground task
@@ -557,7 +1723,7 @@ void handle_sigquit(int sig) {
   }
   // Otherwise if there is a foreground task, send SIGTSTP signal to it
   if (fg_task != NULL) {
-    kill(fg_task->pid, SIGTSTP);
+    kill(-fg_task->pgid, SIGTSTP);
     log_hiy_sig_sent(LOG_CMD_SUSPEND, fg_task->num, fg_task->pid);
   }
   // Find the next task and run it in foreground
@@ -574,17 +1740,37 @@ void handle_sigquit(int sig) {
   task_to_promote = next_task->num;
 }
 
-// Function handle_sigchld - handles the SIGCHLD signal
+// Function release_slot - gives back the scheduler slot of a task that is done
 // Input
-//   int sig - signal code
-void handle_sigchld(int sig) {
+//   Task* task - finished or killed task
+void release_slot(Task* task) {
+  if (task->holds_slot) {
+    task->holds_slot = false;
+    slots_used--;
+  }
+}
+
+// Function task_account - records the resources used by a task's last run
+// Input
+//   Task* task - task that just ended
+//   struct rusage* usage - resource usage of its process, from wait4
+void task_account(Task* task, struct rusage* usage) {
+  clock_gettime(CLOCK_MONOTONIC, &task->ended);
+  task->usage = *usage;
+  task_cgroup_collect(task);
+}
+
+// Function handle_sigchld - handles the SIGCHLD signal
+void handle_sigchld() {
   int status;
   pid_t pid;
   Task* task;
+  struct rusage usage;
 
-  // Reap the child processes using waitpid in a loop
+  // Reap the child processes using wait4 in a loop, which also
+  // gives the resources used by the ones that ended
   while (true) {
-    pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED);
+    pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage);
     // Check the error code for interruption, and repeat the wait if needed
     if ((pid < 0) && (errno == EINTR)) {
       continue;
@@ -606,12 +1792,19 @@ void handle_sigchld(int sig) {
           task->exit_code = WEXITSTATUS(status);
           task->state = STATE_FINISHED;
           task->is_fg = false;
+          // The pid may be reused now, so drop it from the table
+          pid_table_remove(task);
+          release_slot(task);
+          task_account(task, &usage);
         }
         // If killed, just update the state and log the change
         else if (WIFSIGNALED(status)) {
           log_hiy_status(task->num, task->cmd, pid, task->state, STATE_KILLED);
           task->state = STATE_KILLED;
           task->is_fg = false;
+          pid_table_remove(task);
+          release_slot(task);
+          task_account(task, &usage);
         }
         // If suspended, just update the state and log the change
         else if (WIFSTOPPED(status)) {
@@ -634,51 +1827,244 @@ void handle_sigchld(int sig) {
       }
     }
   }
+  // Start queued tasks in the slots freed by this batch of children
+  schedule_tasks();
+}
+
+// Function handle_signals - handles every signal queued on sig_fd
+// Output
+//   number of signals handled
+int handle_signals() {
+  struct signalfd_siginfo info[SIG_BATCH];
+  bool child_event = false;
+  int handled = 0;
+  // Read the queued signals in batches until the queue is empty
+  while (true) {
+    ssize_t length = read(sig_fd, info, sizeof(info));
+    if ((length < 0) && (errno == EINTR)) {
+      continue;
+    }
+    else if (length <= 0) {
+      break;
+    }
+    for (int i = 0; i < length / sizeof(info[0]); i++) {
+      switch (info[i].ssi_signo) {
+        case SIGINT:
+          handle_sigint();
+          break;
+        case SIGTSTP:
+          handle_sigtstp();
+          break;
+        case SIGQUIT:
+          handle_sigquit();
+          break;
+        case SIGCHLD:
+          child_event = true;
+          break;
+      }
+      handled++;
+    }
+  }
+  // One waitpid loop reaps the children behind all the SIGCHLDs
+  if (child_event) {
+    handle_sigchld();
+  }
+  return handled;
+}
+
+// Function copy_command - copies a command line out of the input
+// Input
+//   const char* start - start of the line
+//   size_t length - length of the line, without the newline
+// Output
+//   newly allocated command line, or NULL if the line is empty or whitespace
+char* copy_command(const char* start, size_t length) {
+  char* cmdline = (char*)malloc(length + 1);
+  // If error, exit
+  if (cmdline == NULL) {
+    exit(2);
+  }
+  memcpy(cmdline, start, length);
+  cmdline[length] = '\0';
+  // Skip empty and whitespace only lines
+  if (is_whitespace(cmdline)) {
+    free(cmdline);
+    return NULL;
+  }
+  return cmdline;
+}
+
+// Function read_batch_command - reads the next command line from the batch file
+// Output
+//   newly allocated command line, or NULL if the line was empty
+char* read_batch_command() {
+  // Reap the children and move the relays along without sleeping, the
+  // batch never waits for input
+  wait_events(NULL, 0);
+  // If the file is done, run what is left in the queue and quit
+  if (batch_start >= batch_size) {
+    drain_queue();
+    exit(0);
+  }
+  // Return the next line, lines may have any length
+  const char* start = batch + batch_start;
+  const char* newline = memchr(start, '\n', batch_size - batch_start);
+  size_t length = (newline != NULL) ? (size_t)(newline - start) : batch_size - batch_start;
+  batch_start += length + 1;
+  return copy_command(start, length);
+}
+
+// Function read_command - reads the next command line from the standard input,
+//                         handling the signals that arrive in the meantime
+// Output
+//   newly allocated command line, or NULL if the line was empty or a
+//   signal was handled while waiting for a new line
+char* read_command() {
+  if (batch != NULL) {
+    return read_batch_command();
+  }
+  while (true) {
+    // If the buffer holds a full line, or a line filling the buffer, return it
+    char* start = input + input_start;
+    size_t available = input_end - input_start;
+    char* newline = memchr(start, '\n', available);
+    size_t length = (newline != NULL) ? (size_t)(newline - start) : available;
+    if ((newline != NULL) || (available == INPUT_SIZE) || (input_eof && (available > 0))) {
+      input_start += length + (newline != NULL);
+      return copy_command(start, length);
+    }
+    // If the input stream is closed, run what is left in the queue and quit
+    if (input_eof) {
+      drain_queue();
+      exit(0);
+    }
+    // Move the partial line to the front to make room for more input
+    memmove(input, start, available);
+    input_start = 0;
+    input_end = available;
+    // Sleep until there is input, handling signals and relays meanwhile
+    bool input_ready;
+    if ((wait_events(&input_ready, -1) > 0) && (input_end == 0)) {
+      // Give the main loop a chance to promote a task or print a new prompt
+      return NULL;
+    }
+    if (input_ready) {
+      ssize_t count = read(STDIN_FILENO, input + input_end, INPUT_SIZE - input_end);
+      if (count > 0) {
+        input_end += count;
+      }
+      else if (count == 0) {
+        input_eof = true;
+      }
+      else if (errno != EINTR) {
+        exit(1);
+      }
+    }
+  }
+}
+
+// Function open_batch - maps a batch file of commands into memory
+// Input
+//   const char* filename - name of the batch file
+// Output
+//   true if mapped (or empty), false if it cannot be read
+bool open_batch(const char* filename) {
+  struct stat info;
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if ((fd == -1) || (fstat(fd, &info) == -1)) {
+    return false;
+  }
+  batch_size = info.st_size;
+  // An empty file cannot be mapped, point at an empty string instead
+  if (batch_size == 0) {
+    batch = "";
+  }
+  else {
+    batch = mmap(NULL, batch_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (batch == MAP_FAILED) {
+      batch = NULL;
+      close(fd);
+      return false;
+    }
+    madvise(batch, batch_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return true;
 }
 
 /*-------------------------------------------*/
 /*  The entry of your task manager program   */
 /*-------------------------------------------*/
 
-int main() {
+int main(int argc, char* args[]) {
     char *cmd = NULL;
     int do_run_shell = RUN_SHELL;
 
-    // Define sigaction structures
-    struct sigaction sa_sigint;
-    struct sigaction sa_sigtstp;
-    struct sigaction sa_sigquit;
-    struct sigaction sa_sigchld;
-
-    // Initialize and connect the SIGINT signal handler
-    memset(&sa_sigint, 0, sizeof(sa_sigint));
-    sa_sigint.sa_handler = handle_sigint;
-    sigaction(SIGINT, &sa_sigint, NULL);
-
-    // Initialize and connect the SIGTSTP signal handler
-    memset(&sa_sigtstp, 0, sizeof(sa_sigtstp));
-    sa_sigtstp.sa_handler = handle_sigtstp;
-    sigaction(SIGTSTP, &sa_sigtstp, NULL);
-
-    // Initialize and connect the SIGQUIT signal handler
-    memset(&sa_sigquit, 0, sizeof(sa_sigquit));
-    sa_sigquit.sa_handler = handle_sigquit;
-    sigaction(SIGQUIT, &sa_sigquit, NULL);
-
-    // Initialize and connect the SIGCHLD signal handler
-    memset(&sa_sigchld, 0, sizeof(sa_sigchld));
-    sa_sigchld.sa_handler = handle_sigchld;
-    sigaction(SIGCHLD, &sa_sigchld, NULL);
-
-    // Initialize mask for blocking the signals
+    // Write out the state changes still held by the logging at exit
+    atexit(log_hiy_flush);
+
+    // The queue runs one task per online CPU unless told otherwise
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    max_slots = (cpus > 0) ? cpus : 1;
+
+    // With --batch FILE, run the commands in FILE without prompts,
+    // and buffer the logs. With --jobs K, run up to K queued tasks at once.
+    // With --cgroup DIR, run each task in its own cgroup under DIR,
+    // so its usage is accounted and its resources can be limited.
+    for (int i = 1; i < argc; i++) {
+      if ((strcmp(args[i], "--batch") == 0) && (i + 1 < argc)) {
+        i++;
+        if (!open_batch(args[i])) {
+          fprintf(stderr, "hiy: cannot read batch file %s\n", args[i]);
+          return 1;
+        }
+        log_hiy_buffer(true);
+      }
+      else if ((strcmp(args[i], "--jobs") == 0) && (i + 1 < argc) && (atoi(args[i + 1]) > 0)) {
+        i++;
+        max_slots = atoi(args[i]);
+      }
+      else if ((strcmp(args[i], "--cgroup") == 0) && (i + 1 < argc)) {
+        i++;
+        if (!open_cgroups(args[i])) {
+          fprintf(stderr, "hiy: cannot open cgroup directory %s\n", args[i]);
+          return 1;
+        }
+      }
+      else {
+        fprintf(stderr, "Usage: %s [--batch FILE] [--jobs K] [--cgroup DIR]\n", args[0]);
+        return 1;
+      }
+    }
+
+    // Initialize mask for the signals handled through sig_fd
+    sigemptyset(&mask);
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGTSTP);
     sigaddset(&mask, SIGQUIT);
     sigaddset(&mask, SIGCHLD);
 
+    // Block the signals for good, and queue them on a signalfd instead,
+    // so they are handled from the main loop rather than in handlers
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+    sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    // If error, exit
+    if (sig_fd == -1) {
+      exit(1);
+    }
+
+    // Ignore SIGPIPE, a relay finds out about a finished consumer from EPIPE.
+    // The tasks get the default action back when spawned.
+    struct sigaction sa_sigpipe;
+    memset(&sa_sigpipe, 0, sizeof(sa_sigpipe));
+    sa_sigpipe.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa_sigpipe, NULL);
+
     /* Intial Prompt and Welcome */
-    log_hiy_intro();
-    log_hiy_help();
+    if (batch == NULL) {
+      log_hiy_intro();
+      log_hiy_help();
+    }
 
     /* Shell looping here to accept user command and execute */
     while (do_run_shell == RUN_SHELL) {
@@ -692,10 +2078,12 @@ int main() {
         }
 
         /* Print prompt */
-        log_hiy_prompt();
+        if (batch == NULL) {
+          log_hiy_prompt();
+        }
 
         /* Get Input - Allocates memory for the cmd copy */
-        cmd = get_input();
+        cmd = read_command();
         /* If the input is whitespace/invalid, get new input from the user. */
         if(cmd == NULL) {
           continue;
@@ -728,35 +2116,43 @@ int main() {
         }
         /*==BUILT_IN: list===*/
         else if (strcmp(inst.instruct, "list") == 0) {
-          // Block the signals
-          sigprocmask(SIG_BLOCK, &mask, &old_mask);
           // Log the number of tasks
           log_hiy_num_tasks(task_number);
           // Log the information for each task in the list
           log_task_list();
-          // Unblock the signals
-          sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        }
+        /*==BUILT_IN: limit TASKNUM|queue [cpu=PERCENT] [mem=SIZE] [cpus=LIST]===*/
+        else if (strcmp(inst.instruct, "limit") == 0) {
+          set_limits(inst.num, inst.cpu_max, inst.memory_max, inst.cpus);
+        }
+        /*==BUILT_IN: dump [> FILE]===*/
+        else if (strcmp(inst.instruct, "dump") == 0) {
+          dump_tasks(inst.outfile);
         }
         /*==BUILT_IN: delete TASKNUM===*/
         else if (strcmp(inst.instruct, "delete") == 0) {
-          // Block the signals
-          sigprocmask(SIG_BLOCK, &mask, &old_mask);
           // Delete the task from the list
           delete_task(inst.num);
-          // Unblock the signals
-          sigprocmask(SIG_SETMASK, &old_mask, NULL);
         }
         /*==BUILT_IN: start TASKNUM [< INFILE] [> OUTFILE]===*/
         else if (strcmp(inst.instruct, "start") == 0) {
-          start_task(inst.num, inst.infile, inst.outfile, STATE_RUN_FG, NULL);
+          start_task(inst.num, inst.infile, inst.outfile, STATE_RUN_FG);
         }
         /*==BUILT_IN: startbg TASKNUM [< INFILE] [> OUTFILE]===*/
         else if (strcmp(inst.instruct, "startbg") == 0) {
-          start_task(inst.num, inst.infile, inst.outfile, STATE_RUN_BG, NULL);
+          start_task(inst.num, inst.infile, inst.outfile, STATE_RUN_BG);
         }
-        /*==BUILT_IN: pipe TASKNUM1 TASKNUM2===*/
+        /*==BUILT_IN: pipe TASKNUM1 TASKNUM2 [TASKNUM3...]===*/
         else if (strcmp(inst.instruct, "pipe") == 0) {
-          pipe_tasks(inst.num, inst.num2);
+          pipe_tasks(inst.nums, inst.num_count);
+        }
+        /*==BUILT_IN: tee TASKNUM1 TASKNUM2 [TASKNUM3...]===*/
+        else if (strcmp(inst.instruct, "tee") == 0) {
+          tee_tasks(inst.nums, inst.num_count);
+        }
+        /*==BUILT_IN: queue TASKNUM [PRIORITY]===*/
+        else if (strcmp(inst.instruct, "queue") == 0) {
+          queue_task(inst.num, inst.num2);
         }
         /*==BUILT_IN: fg TASKNUM===*/
         else if (strcmp(inst.instruct, "fg") == 0) {
@@ -776,12 +2172,8 @@ int main() {
         }
         /*==USER COMMAND===*/
         else {
-          // Block the signals
-          sigprocmask(SIG_BLOCK, &mask, &old_mask);
           // Add the new task to the list
           add_task(cmd, argv);
-          // Unblock the signals
-          sigprocmask(SIG_SETMASK, &old_mask, NULL);
         }
 
         /*.===============================================.
@@ -1,20 +1,131 @@
-/* Do Not Modify This File */
+/* Logging for HIY: every message goes through here, state changes through
+ * a ring of binary records written in batches. */
 
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "logging.h"
 
 #define BUFSIZE 255
+#define LOG_BUFFER_SIZE 65536 /* stderr buffer size when the logs are buffered */
+#define LOG_TEXT_WIDTH 99 /* most characters of a command or file name shown, so messages fit in BUFSIZE */
+#define LOG_RING_SIZE 1024 /* status records held before they are formatted, a power of two */
+#define LOG_DRAIN_SIZE 16384 /* bytes of formatted status messages written at once */
+
+/* A task state change, kept in binary until the ring is drained */
+typedef struct {
+  struct timespec time; /* when the change was logged */
+  int task_id;
+  int pid;
+  unsigned char from;
+  unsigned char to;
+  unsigned char cmd_length; /* bytes of cmd in use */
+  char cmd[LOG_TEXT_WIDTH]; /* the shown part of the command, not terminated,
+                               copied as the task may be gone when it is formatted */
+} LogRecord;
 
-#define textproc_log(s) fprintf(stderr,"\033[1;31m%s%s\033[0m",log_hiy_head, s); fflush(stderr)
-#define textproc_unmarked_log(s) fprintf(stderr,"\033[1;31m%s\033[0m", s); fflush(stderr)
+static const char *log_hiy_head = "[HIY-LOG] ";
+static const char *task_state[] = { "Ready", "Running FG", "Running BG", "Suspended", "Finished", "Killed", "Queued", NULL };
+static int log_buffered = 0;
+
+/* Ring of the status records not yet written.  The signals are handled from
+ * the main loop, so the one producer and the consumer share a thread, and
+ * the indexes need no locking.  They run freely, masked on use. */
+static LogRecord log_ring[LOG_RING_SIZE];
+static unsigned int log_ring_head = 0; /* next record to format */
+static unsigned int log_ring_tail = 0; /* next free record */
+
+static void log_ring_drain();
+
+/* When log_buffered is set, the messages collect in the stderr buffer and
+ * are written by log_hiy_flush(), or when the buffer fills up.  The status
+ * records still in the ring go first, so the messages stay in order. */
+static void textproc_log(const char *s) {
+  log_ring_drain();
+  fprintf(stderr, "\033[1;31m%s%s\033[0m", log_hiy_head, s);
+  if (!log_buffered) { fflush(stderr); }
+}
+
+static void textproc_write(const char *s) {
+  char output[BUFSIZE] = {0};
+  log_ring_drain();
+  snprintf(output, BUFSIZE - 1, "\033[1;31m%s%s\033[0m", log_hiy_head, s);
+  if (log_buffered) { fputs(output, stderr); }
+  else { write(STDERR_FILENO, output, strlen(output)); }
+}
 
-#define textproc_write(s) char output[BUFSIZE] = {0}; snprintf(output,BUFSIZE-1,"\033[1;31m%s%s\033[0m", log_hiy_head, s); write(STDERR_FILENO, output, strlen(output));
+/* Turns buffering of the log messages on or off */
+void log_hiy_buffer(int buffered) {
+  fflush(stderr);
+  setvbuf(stderr, NULL, buffered ? _IOFBF : _IONBF, LOG_BUFFER_SIZE);
+  log_buffered = buffered;
+}
 
-static const char *log_hiy_head = "[HIY-LOG] ";
-static const char *task_state[] = { "Ready", "Running FG", "Running BG", "Suspended", "Finished", "Killed", NULL };
+/* Writes out the buffered log messages */
+void log_hiy_flush() {
+  log_ring_drain();
+  if (log_buffered) {
+    fflush(stderr);
+  }
+}
+
+/* Writes formatted messages out, through the stderr buffer if the logs are buffered */
+static void log_emit(const char *text, size_t length) {
+  if (log_buffered) {
+    fwrite(text, 1, length, stderr);
+    return;
+  }
+  while (length > 0) {
+    ssize_t written = write(STDERR_FILENO, text, length);
+    if (written <= 0) {
+      return;
+    }
+    text += written;
+    length -= written;
+  }
+}
+
+/* Formats a status change message */
+static void format_status(char *buffer, int task_id, const char *cmd, int cmd_length, int pid, int from, int to) {
+  static const char* msgs[] = {"", "(Terminated Normally)", "(Terminated by Signal)", "(Continued)", "(Stopped)", "(Started)"};
+  static const char* types[] = {"", "Foreground ", "Background "};
+
+  int msg = 0;
+  if (to == LOG_STATE_FINISHED) { msg = 1; }
+  else if (to == LOG_STATE_KILLED) { msg = 2; }
+  else if (from == LOG_STATE_SUSPENDED && to < LOG_STATE_SUSPENDED) { msg = 3; }
+  else if (to == LOG_STATE_SUSPENDED) { msg = 4; }
+  else if (from == LOG_STATE_READY || from == LOG_STATE_QUEUED) { msg = 5; }
+
+  int type = 0;
+  if (from == LOG_STATE_RUN_FG) { type = 1; }
+  else if (from == LOG_STATE_RUN_BG) { type = 2; }
+
+  snprintf(buffer, BUFSIZE, "%sProcess %d (Task %d; %.*s) changed from %s to %s %s\n", types[type], pid, task_id, cmd_length, cmd, task_state[from], task_state[to], msgs[msg]);
+}
+
+/* Formats the status records in the ring and writes them out in batches */
+static void log_ring_drain() {
+  char output[LOG_DRAIN_SIZE];
+  char buffer[BUFSIZE];
+  size_t length = 0;
+  while (log_ring_head != log_ring_tail) {
+    LogRecord *record = &log_ring[log_ring_head & (LOG_RING_SIZE - 1)];
+    format_status(buffer, record->task_id, record->cmd, record->cmd_length, record->pid, record->from, record->to);
+    // Write the batch out when the next message might not fit
+    if (length + BUFSIZE + 32 > LOG_DRAIN_SIZE) {
+      log_emit(output, length);
+      length = 0;
+    }
+    length += snprintf(output + length, LOG_DRAIN_SIZE - length, "\033[1;31m%s%s\033[0m", log_hiy_head, buffer);
+    log_ring_head++;
+  }
+  if (length > 0) {
+    log_emit(output, length);
+  }
+}
 
 /* Outputs an Introductory message at the start of the program */
 void log_hiy_intro() { 
@@ -31,7 +142,10 @@ void log_hiy_help() {
   textproc_log("    startbg TASK [< INFILE] [> OUTFILE],\n");
   textproc_log("    kill TASK, suspend TASK,\n");
   textproc_log("    fg TASK, bg TASK,\n");
-  textproc_log("    pipe TASK1 TASK2\n");
+  textproc_log("    queue TASK [PRIORITY], dump [> FILE],\n");
+  textproc_log("    limit TASK|queue [cpu=PERCENT] [mem=SIZE] [cpus=LIST],\n");
+  textproc_log("    pipe TASK1 TASK2 [TASK3...],\n");
+  textproc_log("    tee TASK1 TASK2 [TASK3...]\n");
   textproc_log("\n");
   textproc_log("Brackets denote optional arguments\n");
 }
@@ -43,6 +157,7 @@ void log_hiy_quit(){
 
 /* Outputs the prompt */
 void log_hiy_prompt() {
+  log_hiy_flush();
   printf("HIY$ ");
   fflush(stdout);
 }
@@ -50,21 +165,31 @@ void log_hiy_prompt() {
 /* Outputs a notification of a task deletion */
 void log_hiy_delete(int task_id) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Deleting Task ID %d\n", task_id);
+  snprintf(buffer, BUFSIZE, "Deleting Task ID %d\n", task_id);
   textproc_log(buffer);
 }
 
 /* Outputs a notification of an error due to action in an incompatible state. */
 void log_hiy_status_error(int task_id, int status) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error acting on Task ID %d due to process in %s state\n", task_id, task_state[status]);
+  snprintf(buffer, BUFSIZE, "Error acting on Task ID %d due to process in %s state\n", task_id, task_state[status]);
   textproc_log(buffer);
 }
 
 /* Outputs a notification of an file error */
 void log_hiy_file_error(int task_id, const char *file) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error opening file %s for Task %d\n", file, task_id);
+  snprintf(buffer, BUFSIZE, "Error opening file %.*s for Task %d\n", LOG_TEXT_WIDTH, file, task_id);
+  textproc_log(buffer);
+}
+
+/* Outputs a notification that a resource limit cannot be read or set, for task 0 on the queue */
+void log_hiy_limit_error(int task_id, const char *setting) {
+  char buffer[BUFSIZE] = {0};
+  if (task_id == 0)
+  { snprintf(buffer, BUFSIZE, "Error setting %.*s for the queue\n", LOG_TEXT_WIDTH, setting); }
+  else
+  { snprintf(buffer, BUFSIZE, "Error setting %.*s for Task %d\n", LOG_TEXT_WIDTH, setting, task_id); }
   textproc_log(buffer);
 }
 
@@ -73,21 +198,21 @@ void log_hiy_file_error(int task_id, const char *file) {
  */ 
 void log_hiy_run_error(const char *line) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error: %s: Command Cannot Load\n", line);
+  snprintf(buffer, BUFSIZE, "Error: %.*s: Command Cannot Load\n", LOG_TEXT_WIDTH, line);
   textproc_log(buffer);
 }
 
 /* Output when activating a new task */
 void log_hiy_task_init(int task_id, const char *cmd) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Adding Task ID %d: %s (Ready)\n", task_id, cmd);
+  snprintf(buffer, BUFSIZE, "Adding Task ID %d: %.*s (Ready)\n", task_id, LOG_TEXT_WIDTH, cmd);
   textproc_write(buffer);
 } 
 
 /* Output when the given task id is not found */
 void log_hiy_task_id_error(int task_id) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error: Task ID %d Not Found in Task List\n", task_id);
+  snprintf(buffer, BUFSIZE, "Error: Task ID %d Not Found in Task List\n", task_id);
   textproc_write(buffer);
 }
 
@@ -114,7 +239,7 @@ void log_hiy_sig_sent(int sig_type, int task_id, int pid) {
           textproc_write("Invalid input to log_hiy_sig_sent\n");
           return;
   }
-  sprintf(buffer,"%s message sent to Task ID %d (PID %d)\n", sigs[sig_type], task_id, pid);
+  snprintf(buffer, BUFSIZE, "%s message sent to Task ID %d (PID %d)\n", sigs[sig_type], task_id, pid);
   textproc_log(buffer);
 }
 
@@ -122,61 +247,127 @@ void log_hiy_sig_sent(int sig_type, int task_id, int pid) {
  * (Signal Handler Safe Outputting)
  */
 void log_hiy_status(int task_id, const char *cmd, int pid, int from, int to) {
-  char buffer[BUFSIZE] = {0};
-  static const char* msgs[] = {"", "(Terminated Normally)", "(Terminated by Signal)", "(Continued)", "(Stopped)", "(Started)"};
-  static const char* types[] = {"", "Foreground ", "Background "};
-
-  int msg = 0;
-  if (to == LOG_STATE_FINISHED) { msg = 1; }
-  else if (to == LOG_STATE_KILLED) { msg = 2; }
-  else if (from == LOG_STATE_SUSPENDED && to < LOG_STATE_SUSPENDED) { msg = 3; }
-  else if (to == LOG_STATE_SUSPENDED) { msg = 4; }
-  else if (from == LOG_STATE_READY) { msg = 5; }
-
-  int type = 0;
-  if (from == LOG_STATE_RUN_FG) { type = 1; }
-  else if (from == LOG_STATE_RUN_BG) { type = 2; }
-
-  if (from < 0 || from > 5 || to < 0 || to > 5) {
+  if (from < 0 || from > LOG_STATE_QUEUED || to < 0 || to > LOG_STATE_QUEUED) {
           textproc_write("Invalid input to log_hiy_status_change\n");
           return;
   }
-  sprintf(buffer,"%sProcess %d (Task %d; %s) changed from %s to %s %s\n", types[type], pid, task_id, cmd, task_state[from], task_state[to], msgs[msg]);
+  /* State changes come in bursts as children exit, so they are only
+   * recorded here, and formatted and written together when the ring is
+   * drained: before any other message, on log_hiy_flush(), or when full.
+   * Unless the logs are buffered, a change to running is written at once,
+   * so it comes before the output of the task. */
+  if (log_ring_tail - log_ring_head == LOG_RING_SIZE) {
+    log_ring_drain();
+  }
+  LogRecord *record = &log_ring[log_ring_tail & (LOG_RING_SIZE - 1)];
+  clock_gettime(CLOCK_MONOTONIC, &record->time);
+  record->task_id = task_id;
+  record->pid = pid;
+  record->from = from;
+  record->to = to;
+  record->cmd_length = strnlen(cmd, LOG_TEXT_WIDTH);
+  memcpy(record->cmd, cmd, record->cmd_length);
+  log_ring_tail++;
+  if (!log_buffered && (to == LOG_STATE_RUN_FG || to == LOG_STATE_RUN_BG)) {
+    log_ring_drain();
+  }
+}
 
-  textproc_write(buffer);
+/* Output when a queued task is cancelled, back to Ready */
+void log_hiy_unqueue(int task_id, const char *cmd) {
+  char buffer[BUFSIZE] = {0};
+  snprintf(buffer, BUFSIZE, "Unqueueing Task %d: %.*s (Ready)\n", task_id, LOG_TEXT_WIDTH, cmd);
+  textproc_log(buffer);
+}
+
+/* Output when a task is queued */
+void log_hiy_queue(int task_id, const char *cmd, int priority) {
+  char buffer[BUFSIZE] = {0};
+  snprintf(buffer, BUFSIZE, "Queueing Task %d: %.*s (priority %d)\n", task_id, LOG_TEXT_WIDTH, cmd, priority);
+  textproc_log(buffer);
 }
 
 /* Output to list the task counts */
 void log_hiy_num_tasks(int num_tasks){
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "%d Task(s)\n", num_tasks);
+  snprintf(buffer, BUFSIZE, "%d Task(s)\n", num_tasks);
   textproc_log(buffer);
 }
 
 /* Output info about a single task */
 void log_hiy_task_info(int task_id, const char* cmd, int status, int pid, int exit_code) {
   char buffer[BUFSIZE] = {0};
-  if (status < 0 || status > 5) {
+  if (status < 0 || status > LOG_STATE_QUEUED) {
           textproc_write("Invalid input to log_hiy_task_info\n");
           return;
   }
   if (!cmd) 
-  { sprintf(buffer, "Task %d: (%s)\n", task_id, task_state[status]); }
+  { snprintf(buffer, BUFSIZE, "Task %d: (%s)\n", task_id, task_state[status]); }
   else if (!pid) 
-  { sprintf(buffer, "Task %d: %s (%s)\n", task_id, cmd, task_state[status]); }
+  { snprintf(buffer, BUFSIZE, "Task %d: %.*s (%s)\n", task_id, LOG_TEXT_WIDTH, cmd, task_state[status]); }
   else if (status != LOG_STATE_FINISHED && status != LOG_STATE_KILLED) 
-  { sprintf(buffer, "Task %d: %s (PID %d; %s)\n", task_id, cmd, pid, task_state[status]); }
+  { snprintf(buffer, BUFSIZE, "Task %d: %.*s (PID %d; %s)\n", task_id, LOG_TEXT_WIDTH, cmd, pid, task_state[status]); }
   else
-  { sprintf(buffer, "Task %d: %s (PID %d; %s; exit code %d)\n", task_id, cmd, pid, task_state[status], exit_code); }
+  { snprintf(buffer, BUFSIZE, "Task %d: %.*s (PID %d; %s; exit code %d)\n", task_id, LOG_TEXT_WIDTH, cmd, pid, task_state[status], exit_code); }
 
   textproc_log(buffer);
 }
 
 
+/* Output the resources used by a task's last run, negative values are unknown */
+void log_hiy_task_usage(int task_id, double wall, double user, double sys, long max_rss_kb, long vol_switches, long invol_switches, long long cg_cpu_usec, long long cg_memory_peak) {
+  char buffer[BUFSIZE] = {0};
+  int length = snprintf(buffer, BUFSIZE, "    Task %d usage: wall %.3fs", task_id, wall);
+  if (user >= 0) {
+    length += snprintf(buffer + length, BUFSIZE - length, "; user %.3fs; sys %.3fs; max RSS %ld KB; context switches %ld voluntary, %ld involuntary",
+                       user, sys, max_rss_kb, vol_switches, invol_switches);
+  }
+  if (cg_cpu_usec >= 0) {
+    length += snprintf(buffer + length, BUFSIZE - length, "; cgroup CPU %.3fs", cg_cpu_usec / 1e6);
+  }
+  if (cg_memory_peak >= 0) {
+    length += snprintf(buffer + length, BUFSIZE - length, "; cgroup peak %lld KB", cg_memory_peak / 1024);
+  }
+  snprintf(buffer + length, BUFSIZE - length, "\n");
+  textproc_log(buffer);
+}
+
+/* Output the resource limits of a task, or of the queue for task 0 */
+void log_hiy_limits(int task_id, int cpu_max, long long memory_max, const char *cpus) {
+  char buffer[BUFSIZE] = {0};
+  int length;
+  if (task_id == 0)
+  { length = snprintf(buffer, BUFSIZE, "Queue limits:"); }
+  else
+  { length = snprintf(buffer, BUFSIZE, "    Task %d limits:", task_id); }
+  if (!cpu_max && !memory_max && !cpus) {
+    length += snprintf(buffer + length, BUFSIZE - length, " none");
+  }
+  if (cpu_max) {
+    length += snprintf(buffer + length, BUFSIZE - length, " CPU %d%%;", cpu_max);
+  }
+  if (memory_max) {
+    length += snprintf(buffer + length, BUFSIZE - length, " memory %lld KB;", memory_max / 1024);
+  }
+  if (cpus) {
+    length += snprintf(buffer + length, BUFSIZE - length, " CPUs %.*s;", LOG_TEXT_WIDTH, cpus);
+  }
+  snprintf(buffer + length, BUFSIZE - length, "\n");
+  textproc_log(buffer);
+}
+
+/* Name of a task state, for machine-readable output */
+const char *log_hiy_state_name(int status) {
+  if (status < 0 || status > LOG_STATE_QUEUED) {
+    return "Unknown";
+  }
+  return task_state[status];
+}
+
 /* Output when the given task number is not found */
 void log_hiy_task_num_error(int task_num) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error: Task %d Not Found in Task List\n", task_num);
+  snprintf(buffer, BUFSIZE, "Error: Task %d Not Found in Task List\n", task_num);
   textproc_write(buffer);
 }
 
@@ -188,21 +379,28 @@ void log_hiy_redir(int task_num, int redir_type, const char *file) {
 	  textproc_write("Invalid input to log_hiy_anav_redir\n");
 	  return;
   }
-  sprintf(buffer, "Redirecting %s %s %s for Task %d\n", types[redir_type], polarity[redir_type], file, task_num);
+  snprintf(buffer, BUFSIZE, "Redirecting %s %s %.*s for Task %d\n", types[redir_type], polarity[redir_type], LOG_TEXT_WIDTH, file, task_num);
   textproc_log(buffer);
 }
 
 /* Outputs a notification of the creation of a pipe */
 void log_hiy_pipe(int task_id1, int task_id2) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Opening a pipe from Task %d to Task %d\n", task_id1, task_id2);
+  snprintf(buffer, BUFSIZE, "Opening a pipe from Task %d to Task %d\n", task_id1, task_id2);
   textproc_log(buffer);
 }
 
 /* Outputs a notification of an error piping a program's output to itself */
 void log_hiy_pipe_error(int task_num) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error attempting to pipe Task %d's output to itself\n", task_num);
+  snprintf(buffer, BUFSIZE, "Error attempting to pipe Task %d's output to itself\n", task_num);
+  textproc_log(buffer);
+}
+
+/* Output when a pipe or tee is given more task numbers than it can take, or a bad one */
+void log_hiy_stages_error(int max_stages) {
+  char buffer[BUFSIZE] = {0};
+  snprintf(buffer, BUFSIZE, "Error: a pipe or tee takes 2 to %d Task Numbers\n", max_stages);
   textproc_log(buffer);
 }
 
@@ -211,6 +409,6 @@ void log_hiy_pipe_error(int task_num) {
  */ 
 void log_hiy_start_error(const char *line) {
   char buffer[BUFSIZE] = {0};
-  sprintf(buffer, "Error: %s: Command Cannot Load\n", line);
+  snprintf(buffer, BUFSIZE, "Error: %.*s: Command Cannot Load\n", LOG_TEXT_WIDTH, line);
   textproc_log(buffer);
 }
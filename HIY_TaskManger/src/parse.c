@@ -1,9 +1,9 @@
-/* DO NOT modify this file.
- * This is the provided parsing facility. 
+/* The parsing facility of HIY.
  * You can call parse() to divide the user command line into useful pieces. */
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
 
 #include "parse.h"
 #include "hiy.h"
@@ -14,7 +14,9 @@ static void parse_n(const char *cmd_line, Instruction *inst, char *argv[], size_
 static int initialize_argv_n(char *argv[], size_t n);
 static int contains(const char *needle, char *haystack[]);
 static int parse_num_token(char *inst_list[], const char *p_tok, const char *instruct, int *num);
+static int parse_num_list(char *inst_list[], char **p_toks, const char *instruct, int nums[], int *num_count);
 static int parse_file_token(char *inst_list[], char **p_toks, const char *instruct, char **infile, char **outfile);
+static int parse_limit_tokens(char *inst_list[], char **p_toks, const char *instruct, Instruction *inst);
 char **get_redirect_file(char **p_toks, char **file);
 static int is_redirect_in(const char *p_tok);
 static int is_redirect_out(const char *p_tok);
@@ -23,62 +25,30 @@ static void DPRINTF(const char* fmt, ...);
 /* Reference Data */
 
 // full recognized instruction list
-static char *instructs_list_full[] = {"quit", "help", "list", "delete", "start", "startbg", "kill", "suspend", "fg", "bg", "pipe", NULL};
+static char *instructs_list_full[] = {"quit", "help", "list", "dump", "delete", "start", "startbg", "kill", "suspend", "fg", "bg", "pipe", "tee", "queue", "limit", NULL};
 
 // instructions which may use an Task Number argument
-static char *instructs_with_num[] = {"delete", "start", "startbg", "kill", "suspend", "fg", "bg", "pipe", NULL};
+static char *instructs_with_num[] = {"delete", "start", "startbg", "kill", "suspend", "fg", "bg", "pipe", "tee", "queue", "limit", NULL};
 
-// instructions which may use a 2nd Task Number argument
-static char *instructs_with_num2[] = {"pipe", NULL};
+// instructions which may use a 2nd Task Number argument (the priority, for queue)
+static char *instructs_with_num2[] = {"pipe", "tee", "queue", NULL};
+
+// instructions which may use a list of Task Number arguments
+static char *instructs_with_num_list[] = {"pipe", "tee", NULL};
 
 // instructions which may use filename arguments
 static char *instructs_with_file[] = {"start", "startbg", NULL};
 
+// instructions which may use filename arguments with no task number before them
+static char *instructs_with_file_only[] = {"dump", NULL};
+
+// instructions which may use resource limit arguments
+static char *instructs_with_limits[] = {"limit", NULL};
+
 /*********
  * Command Parsing Functions
  *********/
 
-char *get_input() {
-  char buffer[MAXLINE] = {0};
-
-  /* Step 0: Read in the line from the user */
-  errno = 0;
-  if(fgets(buffer, MAXLINE, stdin) == NULL) {
-    if(errno == EINTR) {
-      return NULL;
-    }
-    exit(1);
-  }
-
-  /* Step 1: Check for Termination Condition (input stream closed) */
-  if(feof(stdin)) {
-    exit(0);
-  }
-
-  /* Step 2: Check for empty entries */
-  if(strlen(buffer) == 1) {
-    return NULL;
-  }
-
-  /* Step 3: Strip the newline */
-  strtok(buffer, "\n");
-
-  /* Step 4: Check for only whitespace */
-  if(is_whitespace(buffer)) {
-    return NULL;
-  }
-
-  /* Step 5: Copy the buffer to the command and return it */
-  char *cmdline = calloc(strlen(buffer) + 1, sizeof(char));
-  if(cmdline == NULL) {
-    exit(2);
-  }
-  strncpy(cmdline, buffer, strlen(buffer) + 1);
-
-  return cmdline;
-}
-
-
 void parse(const char *cmd_line, Instruction *inst, char *argv[]) {
     initialize_argv_n(argv, MAXARGS+1);
     parse_n(cmd_line, inst, argv, MAXARGS);
@@ -93,12 +63,12 @@ static void parse_n(const char *cmd_line, Instruction *inst, char *argv[], size_
 
   /* Step 1: Only work on a copy of the original command */ 
     char *p_tok = NULL;
-    char buffer[MAXLINE] = {0};
-    strncpy(buffer, cmd_line, MAXLINE);
+    char *buffer = string_copy(cmd_line);
+    if (!buffer) { return; }
 
   /* Step 2: Tokenize the inputs (space delim) and parse */
     p_tok = strtok(buffer, " ");
-    if (p_tok == NULL) { return; }
+    if (p_tok == NULL) { free(buffer); return; }
 
     int index = 0;
 
@@ -119,13 +89,24 @@ static void parse_n(const char *cmd_line, Instruction *inst, char *argv[], size_
     /* Step 2c: Parse the 2nd Task Number */
     parse_num_token(instructs_with_num2, argv[2], inst->instruct, &inst->num2);
 
+    /* Step 2c': Parse the whole list of Task Numbers */
+    parse_num_list(instructs_with_num_list, argv+1, inst->instruct, inst->nums, &inst->num_count);
+
     /* Step 2d: Parse the file names */
     parse_file_token(instructs_with_file, argv+2, inst->instruct, &inst->infile, &inst->outfile);
+    parse_file_token(instructs_with_file_only, argv+1, inst->instruct, &inst->infile, &inst->outfile);
+
+    /* Step 2e: Parse the resource limits, for a Task Number or the queue */
+    if (parse_limit_tokens(instructs_with_limits, argv+2, inst->instruct, inst)) {
+        if (!argv[1] || (inst->num == 0 && strcmp(argv[1], "queue") != 0)) { inst->num = -1; }
+    }
 
     /* Step 3: if the instruction is a built-in, clear argv */
     if (contains(inst->instruct, instructs_list_full)) {
         free_argv_str(argv);
     } 
+
+    free(buffer);
 }
 
 
@@ -154,6 +135,78 @@ static int parse_num_token(char *inst_list[], const char *p_tok, const char *ins
     return 1;
 }
 
+/* Parse a list of Task Numbers from the current tokens.  Reads numbers until
+ * the tokens run out, a token is not a number, or MAXSTAGES numbers are read.
+ * Returns true if the instruction takes a list, else false.  The nums argument
+ * is populated with the numbers and num_count with how many there are, or
+ * STAGES_INVALID if any token is left over, so a list is never truncated.
+ */
+static int parse_num_list(char *inst_list[], char **p_toks, const char *instruct, int nums[], int *num_count) {
+    // sanity check for valid input
+    if (!inst_list || !p_toks || !instruct || !nums || !num_count) { return 0; }
+
+    // only instructions in the inst_list are under consideration
+    if (!contains(instruct, inst_list)) { return 0; }
+
+    *num_count = 0;
+    while (*p_toks && *num_count < MAXSTAGES) {
+        if (!parse_num_token(inst_list, *p_toks, instruct, &nums[*num_count])) { break; }
+        (*num_count)++;
+        p_toks++;
+    }
+    if (*p_toks) { *num_count = STAGES_INVALID; }
+
+    return 1;
+}
+
+/* Parse resource limits from the current tokens, each one of cpu=PERCENT,
+ * mem=SIZE[K|M|G] or cpus=LIST.  Returns true if the instruction takes limits,
+ * else false.  The limit fields of inst are populated from the tokens, and
+ * cpu_max is set to LIMIT_INVALID if a token is not a valid limit.
+ */
+static int parse_limit_tokens(char *inst_list[], char **p_toks, const char *instruct, Instruction *inst) {
+    // sanity check for valid input
+    if (!inst_list || !p_toks || !instruct || !inst) { return 0; }
+
+    // only instructions in the inst_list are under consideration
+    if (!contains(instruct, inst_list)) { return 0; }
+
+    while (*p_toks) {
+        char *end = NULL;
+        if (strncmp(*p_toks, "cpu=", 4) == 0) {
+            long percent = strtol(*p_toks + 4, &end, 10);
+            if (end == *p_toks + 4 || *end || percent <= 0 || percent > 100000) { break; }
+            inst->cpu_max = (int) percent;
+        } else if (strncmp(*p_toks, "mem=", 4) == 0) {
+            errno = 0;
+            long long size = strtoll(*p_toks + 4, &end, 10);
+            if (end == *p_toks + 4 || size <= 0 || errno == ERANGE) { break; }
+            // an optional K, M or G suffix scales the size, if it still fits
+            const char *units = "KMG";
+            const char *unit = (*end) ? strchr(units, toupper(*end)) : NULL;
+            if (unit) {
+                int shift = 10 * (unit - units + 1);
+                if (size > (LLONG_MAX >> shift)) { break; }
+                size <<= shift;
+                end++;
+            }
+            if (*end) { break; }
+            inst->memory_max = size;
+        } else if (strncmp(*p_toks, "cpus=", 5) == 0) {
+            const char *list = *p_toks + 5;
+            if (!*list || strspn(list, "0123456789,-") != strlen(list)) { break; }
+            free(inst->cpus);
+            inst->cpus = string_copy(list);
+        } else { break; }
+        p_toks++;
+    }
+
+    // any token left over is not a valid limit
+    if (*p_toks) { inst->cpu_max = LIMIT_INVALID; }
+
+    return 1;
+}
+
 /* Parse a file name from the current token(s).  If the input is a valid redirect 
  * token, and it corresponds to an appropriate instruction, then return true, 
  * else return false.  The file arguments are populated with the file name(s) taken 
@@ -255,6 +308,10 @@ int initialize_instruction(Instruction *inst) {
     inst->instruct = NULL;
     inst->num = 0;
     inst->num2 = 0;
+    inst->num_count = 0;
+    inst->cpu_max = 0;
+    inst->memory_max = 0;
+    inst->cpus = NULL;
     inst->infile = NULL;
     inst->outfile = NULL;
 
@@ -289,6 +346,8 @@ void free_instruction(Instruction *inst) {
 	inst->infile = NULL;
 	free(inst->outfile);
 	inst->outfile = NULL;
+	free(inst->cpus);
+	inst->cpus = NULL;
     }
 
 }
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "motif.h"
+
+// Benchmark and regression harness for the motif finder. Each case is a planted (l, d)
+// instance: n random strings of length l, each holding a copy of one random motif of length
+// m with d of its bases changed. The planted motif is then within d mismatches of every
+// string, so a search with h = d must report it. Instances come from a fixed-seed generator,
+// so every run searches the same strings.
+//
+// Each instance is also searched through libmotif's motif_search, and its motifs must be exactly
+// the ones the finder wrote, so the library and the command line program cannot drift apart.
+
+#define MAX_M 16
+#define MAX_ARGS 32
+
+// One benchmark case
+typedef struct {
+    int n;      // number of strings
+    int l;      // length of each string
+    int m;      // motif length
+    int d;      // mutations per planted copy, searched with h = d
+} BenchCase;
+
+// Cases in increasing size: string count, string length, then motif length with its mutations
+static const BenchCase cases[] = {
+    {10, 200, 6, 1},
+    {20, 200, 6, 1},
+    {20, 600, 8, 2},
+    {40, 600, 8, 2},
+    {20, 1000, 9, 2},
+    {20, 600, 10, 3},
+    {20, 600, 11, 3},
+    {20, 600, 12, 3},
+    {2, 1000000, 10, 2},   // long strings: 4 MB of packed substrings each
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static const char bases[] = "ACGT";
+
+// xorshift64* state, reset for every case so each instance depends only on its parameters
+static uint64_t rng_state;
+
+// Function to seed the generator from a case's parameters
+void rng_seed(const BenchCase *c) {
+    rng_state = 0x9e3779b97f4a7c15ull ^ ((uint64_t)c->n << 48) ^ ((uint64_t)c->l << 16) ^ ((uint64_t)c->m << 8) ^ (uint64_t)c->d;
+}
+
+// Function to draw the next pseudo-random number below bound
+uint32_t rng_below(uint32_t bound) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)(((rng_state * 0x2545f4914f6cdd1dull) >> 32) % bound);
+}
+
+// Function to write a planted instance, in the motif finder's input format, to file and the
+// planted motif to motif
+void gen_instance(FILE *file, const BenchCase *c, char *motif) {
+    char *string = (char *)malloc(c->l + 1);
+    if (string == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    rng_seed(c);
+    for (int j = 0; j < c->m; j++) {
+        motif[j] = bases[rng_below(4)];
+    }
+    motif[c->m] = '\0';
+
+    fprintf(file, "%d\n%d\n%d\n%d\n", c->n, c->l, c->m, c->d);
+    for (int i = 0; i < c->n; i++) {
+        for (int j = 0; j < c->l; j++) {
+            string[j] = bases[rng_below(4)];
+        }
+        string[c->l] = '\0';
+
+        // Plant a copy with exactly d bases changed, each to one of the three other bases
+        int offset = rng_below(c->l - c->m + 1);
+        memcpy(string + offset, motif, c->m);
+        int changed[MAX_M] = {0};
+        for (int k = 0; k < c->d; k++) {
+            int j;
+            do {
+                j = rng_below(c->m);
+            } while (changed[j]);
+            changed[j] = 1;
+            int base = (int)(strchr(bases, motif[j]) - bases);
+            string[offset + j] = bases[(base + 1 + rng_below(3)) % 4];
+        }
+        fprintf(file, "%s\n", string);
+    }
+    free(string);
+}
+
+// Function to pack a motif the way libmotif does: base j is base 4 digit j, A=0 C=1 G=2 T=3
+uint32_t pack_motif(const char *motif, int m) {
+    uint32_t code = 0;
+    for (int j = m - 1; j >= 0; j--) {
+        code = (code << 2) | (uint32_t)(strchr(bases, motif[j]) - bases);
+    }
+    return code;
+}
+
+// Function to order packed motifs
+int order_codes(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to read the motifs of a TSV results file as sorted packed codes into codes, which
+// holds capacity entries. Returns how many the file lists, or -1 if they did not fit.
+long read_codes(const char *filename, int m, uint32_t *codes, size_t capacity) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    char line[64];
+    long count = 0;
+    if (fgets(line, sizeof(line), file) != NULL) {   // header
+        while (fgets(line, sizeof(line), file) != NULL) {
+            if ((size_t)count == capacity) {
+                count = -1;
+                break;
+            }
+            codes[count++] = pack_motif(line, m);
+        }
+    }
+    fclose(file);
+    if (count > 0) {
+        qsort(codes, count, sizeof(uint32_t), order_codes);
+    }
+    return count;
+}
+
+// Function to search an instance through libmotif and compare the motifs with the ones the
+// finder wrote to results. Returns 1 when they are the same.
+int library_agrees(MotifContext *context, const char *input, const BenchCase *c, const MotifParams *params, const char *results) {
+    FILE *file = fopen(input, "r");
+    size_t num_candidates = (size_t)1 << (2 * c->m);
+    char **strings = (char **)calloc(c->n, sizeof(char *));
+    uint32_t *found = (uint32_t *)malloc(num_candidates * sizeof(uint32_t));
+    uint32_t *expected = (uint32_t *)malloc(num_candidates * sizeof(uint32_t));
+    if (file == NULL || strings == NULL || found == NULL || expected == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    int header[4];
+    int same = fscanf(file, "%d %d %d %d", &header[0], &header[1], &header[2], &header[3]) == 4;
+    for (int i = 0; same && i < c->n; i++) {
+        strings[i] = (char *)malloc(c->l + 1);
+        same = strings[i] != NULL && fscanf(file, "%s", strings[i]) == 1;
+    }
+    fclose(file);
+
+    MotifResult result = {found, NULL, num_candidates, 0};
+    if (same) {
+        same = motif_search(context, (const char *const *)strings, c->n, c->l, params, &result) == MOTIF_OK;
+    }
+    long count = same ? read_codes(results, c->m, expected, num_candidates) : -1;
+    same = same && count == (long)result.count && memcmp(found, expected, result.count * sizeof(uint32_t)) == 0;
+
+    for (int i = 0; i < c->n; i++) {
+        free(strings[i]);
+    }
+    free(strings);
+    free(found);
+    free(expected);
+    return same;
+}
+
+// Function to look for motif in a TSV results file. Returns how many motifs the file lists
+// and sets found when motif is one of them.
+long read_results(const char *filename, const char *motif, int *found) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    char line[64];
+    long count = 0;
+    *found = 0;
+    if (fgets(line, sizeof(line), file) == NULL) {   // header
+        fclose(file);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\t\n")] = '\0';
+        if (strcmp(line, motif) == 0) {
+            *found = 1;
+        }
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+// Function to run the motif finder (args, as passed to execv) with input as its stdin.
+// Returns the exit status and fills in the wall time and the child's resource usage.
+int run_finder(char **args, const char *input, double *seconds, struct rusage *usage) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int in = open(input, O_RDONLY);
+        int null = open("/dev/null", O_WRONLY);
+        if (in < 0 || null < 0) {
+            perror("open");
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execv(args[0], args);
+        perror(args[0]);
+        _exit(127);
+    }
+    int status;
+    if (wait4(pid, &status, 0, usage) < 0) {
+        perror("wait4");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > MAX_ARGS - 5) {
+        fprintf(stderr, "Usage: %s FINDER [OPTIONS...]\n", argv[0]);
+        fprintf(stderr, "  runs FINDER -q -o RESULTS [OPTIONS...] on each planted instance\n");
+        return 1;
+    }
+
+    char input[] = "/tmp/motif_bench_inXXXXXX";
+    char results[] = "/tmp/motif_bench_outXXXXXX";
+    int in_fd = mkstemp(input);
+    int out_fd = mkstemp(results);
+    if (in_fd < 0 || out_fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(out_fd);
+
+    // FINDER -q -o RESULTS, then any extra options (a kernel, -r, ...)
+    // The library is given the same strand and quorum options. Options that change what is
+    // searched for in ways it does not support (a subset, a weight matrix, ...) skip the check.
+    char *args[MAX_ARGS];
+    int num_args = 0;
+    int compare = 1;
+    MotifParams params = {0, 0, 0, 0};
+    args[num_args++] = argv[1];
+    args[num_args++] = "-q";
+    args[num_args++] = "-o";
+    args[num_args++] = results;
+    for (int i = 2; i < argc; i++) {
+        args[num_args++] = argv[i];
+        if (strcmp(argv[i], "-r") == 0) {
+            params.both_strands = 1;
+        }
+        else if ((strcmp(argv[i], "-Q") == 0 || strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-M") == 0) && i + 1 < argc) {
+            if (argv[i][1] == 'Q') {
+                params.quorum = atoi(argv[i + 1]);
+            }
+            args[num_args++] = argv[++i];
+        }
+        else {
+            compare = 0;
+        }
+    }
+    args[num_args] = NULL;
+
+    MotifContext *context = motif_context_create();
+    if (context == NULL) {
+        printf("Memory allocation failed\n");
+        return 1;
+    }
+
+    int failures = 0;
+    printf("%4s %6s %3s %2s %10s %10s %14s %8s %-7s %s\n", "n", "l", "m", "h", "seconds", "peak_kb", "candidates/s", "motifs", "planted", "library");
+    for (size_t k = 0; k < NUM_CASES; k++) {
+        const BenchCase *c = &cases[k];
+        char motif[MAX_M + 1];
+        FILE *file = fopen(input, "w");
+        if (file == NULL) {
+            perror(input);
+            return 1;
+        }
+        gen_instance(file, c, motif);
+        fclose(file);
+
+        double seconds;
+        struct rusage usage;
+        int status = run_finder(args, input, &seconds, &usage);
+        int found = 0;
+        long motifs = (status == 0) ? read_results(results, motif, &found) : -1;
+        double candidates = (double)((uint64_t)1 << (2 * c->m));
+        params.m = c->m;
+        params.h = c->d;
+        int agrees = (status == 0 && compare) ? library_agrees(context, input, c, &params, results) : 1;
+
+        printf("%4d %6d %3d %2d %10.3f %10ld %14.0f %8ld %-7s %s\n", c->n, c->l, c->m, c->d, seconds,
+               usage.ru_maxrss, candidates / seconds, motifs, (status != 0) ? "ERROR" : (found ? "found" : "MISSED"),
+               !compare ? "-" : (agrees ? "same" : "DIFFERS"));
+        fflush(stdout);
+        if (status != 0 || !found || !agrees) {
+            failures++;
+        }
+    }
+
+    motif_context_free(context);
+    unlink(input);
+    unlink(results);
+    close(in_fd);
+    if (failures > 0) {
+        printf("%d of %zu cases failed\n", failures, NUM_CASES);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,883 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTIF_X86
+#include <immintrin.h>
+#endif
+
+#include "motif_internal.h"
+
+// Function to check whether bit i of a bitset is set
+int motif_bitset_test(const uint64_t *set, size_t i) {
+    return (set[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+}
+
+// Function to count the bits set in a bitset
+size_t motif_bitset_count(const uint64_t *set, size_t bits) {
+    size_t count = 0;
+    for (size_t w = 0; w < BITSET_WORDS(bits); w++) {
+        count += __builtin_popcountll(set[w]);
+    }
+    return count;
+}
+
+// Function to check whether a bitset has no bits set
+int motif_bitset_empty(const uint64_t *set, size_t bits) {
+    for (size_t w = 0; w < BITSET_WORDS(bits); w++) {
+        if (set[w] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to write candidate number id into motif. Candidates are never stored: id is read as
+// an m digit base 4 number, least significant digit first, so the ids 0..4^m-1 enumerate every
+// motif exactly once and in the same order the old 2d array held them.
+void motif_gen_candidate(size_t id, int m, char *motif) {
+    static const char bases[] = "ACGT";   // are base characters for the motifs
+    for (int j = 0; j < m; j++) {
+        motif[j] = bases[id % 4];   // next base 4 digit picks the letter at position j
+        id /= 4;
+    }
+    motif[m] = '\0';
+}
+
+// Function to generate substrings
+// The views are written into the caller's slice of one shared array, nothing is copied.
+void motif_gen_substrings(int l, int m, Substring *substrings, int *num_substrings) {
+    *num_substrings = l - m + 1;   // calculating number of substring of lenth m that are in the input string.
+    for (int i = 0; i < *num_substrings; i++) {
+        substrings[i].offset = i;   // window i starts at character i
+        substrings[i].length = m;
+    }
+}
+
+// Function to give the 2-bit code of a base: A=0, C=1, G=2, T=3
+static uint32_t encode_base(char base) {
+    switch (base) {
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return 0;   // 'A'
+    }
+}
+
+// Function to pack a substring into 2 bits per base, using the same digit order as the
+// candidate numbers, so a substring's code is the number of the candidate equal to it
+uint32_t motif_encode_substring(const char *str, int m) {
+    uint32_t code = 0;
+    for (int j = m - 1; j >= 0; j--) {
+        code = (code << 2) | encode_base(str[j]);
+    }
+    return code;
+}
+
+// Function to pack every substring of an input string. Consecutive windows share m-1 bases,
+// so each code is the previous one shifted down one base with the new last base added on top.
+void motif_pack_substrings(const char *input_string, Substring *substrings, int num_substrings, int m, uint32_t *codes) {
+    for (int i = 0; i < num_substrings; i++) {
+        if (i > 0 && substrings[i].offset == substrings[i - 1].offset + 1) {
+            codes[i] = (codes[i - 1] >> 2) | (encode_base(input_string[substrings[i].offset + m - 1]) << (2 * (m - 1)));
+        }
+        else {
+            codes[i] = motif_encode_substring(input_string + substrings[i].offset, m);
+        }
+    }
+}
+
+// Function to calculate Hamming distance between two packed motifs. A base differs when
+// either bit of its pair differs, so the pairs are folded onto their low bit and counted.
+static int hamming_dist(uint32_t code1, uint32_t code2) {
+    uint32_t diff = code1 ^ code2;
+    return __builtin_popcount((diff | (diff >> 1)) & 0x55555555u);
+}
+
+// Function to take the reverse complement of a packed motif of length m. Complementing is
+// flipping both bits of a base (A=0 <-> T=3, C=1 <-> G=2); the bases are then reversed by
+// swapping pairs, nibbles and bytes, which leaves the motif in the top 2m bits.
+uint32_t motif_reverse_complement(uint32_t code, int m) {
+    code = ~code;
+    code = ((code >> 2) & 0x33333333u) | ((code & 0x33333333u) << 2);
+    code = ((code >> 4) & 0x0f0f0f0fu) | ((code & 0x0f0f0f0fu) << 4);
+    code = __builtin_bswap32(code);
+    return code >> (32 - 2 * m);
+}
+
+// Function to give the canonical form of a packed motif: the smaller of it and its reverse
+// complement, which is the same for both strands of a double-stranded window
+static uint32_t canonical_code(uint32_t code, int m) {
+    uint32_t reverse = motif_reverse_complement(code, m);
+    return (reverse < code) ? reverse : code;
+}
+
+// Function to add the reverse complement of every motif in a set to the set. A motif is within
+// h mismatches of a window's reverse complement exactly when its own reverse complement is
+// within h of the window, so closing a one-strand match set gives the two-strand one.
+static void close_under_reverse_complement(uint64_t *set, size_t num_candidates, int m) {
+    for (size_t w = 0; w < BITSET_WORDS(num_candidates); w++) {
+        uint64_t bits = set[w];
+        while (bits != 0) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint32_t reverse = motif_reverse_complement((uint32_t)(w * WORD_BITS + bit), m);
+            set[reverse / WORD_BITS] |= (uint64_t)1 << (reverse % WORD_BITS);
+        }
+    }
+}
+
+// Function to compare two packed substrings for qsort
+static int compare_codes(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to count the distinct substrings of an input string. A string with fewer distinct
+// substrings can match fewer candidates, so this is how selective the string is. sorted is
+// scratch space for num_codes codes.
+static int count_distinct_substrings(const uint32_t *codes, int num_codes, uint32_t *sorted) {
+    memcpy(sorted, codes, num_codes * sizeof(uint32_t));
+    qsort(sorted, num_codes, sizeof(uint32_t), compare_codes);
+    int distinct = 0;
+    for (int i = 0; i < num_codes; i++) {
+        if (i == 0 || sorted[i] != sorted[i - 1]) {
+            distinct++;
+        }
+    }
+    return distinct;
+}
+
+// Function to sort packed substrings and drop repeats. Returns how many are left in codes.
+static int unique_codes(uint32_t *codes, int num_codes) {
+    qsort(codes, num_codes, sizeof(uint32_t), compare_codes);
+    int distinct = 0;
+    for (int k = 0; k < num_codes; k++) {
+        if (k == 0 || codes[k] != codes[distinct - 1]) {
+            codes[distinct++] = codes[k];
+        }
+    }
+    return distinct;
+}
+
+// Function to replace packed substrings by their distinct canonical forms, sorted. Returns how
+// many are left in codes. Both orientations of a window collapse into one entry.
+int motif_canonical_substrings(uint32_t *codes, int num_codes, int m) {
+    for (int k = 0; k < num_codes; k++) {
+        codes[k] = canonical_code(codes[k], m);
+    }
+    return unique_codes(codes, num_codes);
+}
+
+// Function to add the reverse complement of every packed substring to codes, which has room for
+// twice num_codes, keeping the distinct ones sorted. Returns how many are left. Scanning both
+// orientations gives two-strand matches directly, for chunks of the candidate space that
+// cannot be closed under reverse complement.
+int motif_both_strand_substrings(uint32_t *codes, int num_codes, int m) {
+    for (int k = 0; k < num_codes; k++) {
+        codes[num_codes + k] = motif_reverse_complement(codes[k], m);
+    }
+    return unique_codes(codes, 2 * num_codes);
+}
+
+// Function to resize an array to count elements of size bytes. On failure the array is
+// returned unchanged and failed is set, so a run of calls needs only one check at the end.
+static void *grow_array(void *array, size_t count, size_t size, int *failed) {
+    void *grown = realloc(array, count * size);
+    if (grown == NULL) {
+        *failed = 1;
+        return array;
+    }
+    return grown;
+}
+
+// Function to append one occurrence, doubling the columns when they are full. If they cannot
+// grow the table is marked failed and the occurrence is dropped.
+static void positions_add(Positions *positions, uint32_t motif, uint32_t string, uint32_t offset, int distance, int strand) {
+    if (positions->count == positions->capacity) {
+        size_t capacity = (positions->capacity == 0) ? 4096 : 2 * positions->capacity;
+        int failed = 0;
+        positions->motif = (uint32_t *)grow_array(positions->motif, capacity, sizeof(uint32_t), &failed);
+        positions->string = (uint32_t *)grow_array(positions->string, capacity, sizeof(uint32_t), &failed);
+        positions->offset = (uint32_t *)grow_array(positions->offset, capacity, sizeof(uint32_t), &failed);
+        positions->distance = (uint8_t *)grow_array(positions->distance, capacity, sizeof(uint8_t), &failed);
+        positions->strand = (uint8_t *)grow_array(positions->strand, capacity, sizeof(uint8_t), &failed);
+        if (failed) {
+            positions->failed = 1;
+            return;
+        }
+        positions->capacity = capacity;
+    }
+    positions->motif[positions->count] = motif;
+    positions->string[positions->count] = string;
+    positions->offset[positions->count] = offset;
+    positions->distance[positions->count] = distance;
+    positions->strand[positions->count] = strand;
+    positions->count++;
+}
+
+// Function to record that motif is within distance of packed substring k of an input string,
+// once for every place that substring occurs. When both strands count, the reverse complement
+// of the motif is then equally close to the reverse complement of the substring, so it is
+// recorded at the same place on the other strand without another comparison.
+static void record_occurrences(Positions *positions, uint32_t motif, int string_index, const PackedString *string, int k, int distance) {
+    uint32_t first = (string->positions == NULL) ? (uint32_t)k : string->starts[k];
+    uint32_t last = (string->positions == NULL) ? (uint32_t)k + 1 : string->starts[k + 1];
+    uint32_t mirror = positions->both_strands ? motif_reverse_complement(motif, positions->m) : 0;
+    for (uint32_t o = first; o < last; o++) {
+        uint32_t offset = (string->positions == NULL) ? o : string->positions[o];
+        positions_add(positions, motif, string_index, offset, distance, 0);
+        if (positions->both_strands) {
+            positions_add(positions, mirror, string_index, offset, distance, 1);
+        }
+    }
+}
+
+// Match kernels: each returns which of the 64 candidates numbered base..base+63 that are set in
+// todo are within h mismatches of at least one of the codes. Bits outside todo come back clear.
+typedef uint64_t (*MatchKernel)(uint32_t base, uint64_t todo, const uint32_t *codes, int num_codes, int h);
+
+// Hit kernels answer the same question as match kernels but also record every occurrence of
+// every matching candidate, so they never stop at the first matching substring.
+typedef uint64_t (*HitKernel)(uint32_t base, uint64_t todo, const PackedString *string, int string_index, int h, Positions *positions);
+
+// Count kernels add one to the count of every candidate set in a match set.
+typedef void (*CountKernel)(HitCounts *counts, const uint64_t *set, size_t words);
+
+// Function for the portable kernel: one candidate against one substring at a time
+static uint64_t match_word_scalar(uint32_t base, uint64_t todo, const uint32_t *codes, int num_codes, int h) {
+    uint64_t found = 0;
+    while (todo != 0) {   // visit only the candidates still in play
+        int bit = __builtin_ctzll(todo);
+        todo &= todo - 1;
+        for (int k = 0; k < num_codes; k++) {
+            if (hamming_dist(base + bit, codes[k]) <= h) {
+                found |= (uint64_t)1 << bit;
+                break;   // one matching substring is enough
+            }
+        }
+    }
+    return found;
+}
+
+// Function for the portable hit kernel
+static uint64_t match_word_hits_scalar(uint32_t base, uint64_t todo, const PackedString *string, int string_index, int h, Positions *positions) {
+    uint64_t found = 0;
+    while (todo != 0) {
+        int bit = __builtin_ctzll(todo);
+        todo &= todo - 1;
+        for (int k = 0; k < string->num_codes; k++) {
+            int dist = hamming_dist(base + bit, string->codes[k]);
+            if (dist <= h) {
+                found |= (uint64_t)1 << bit;
+                record_occurrences(positions, base + bit, string_index, string, k, dist);
+            }
+        }
+    }
+    return found;
+}
+
+// Function for the portable count kernel
+static void add_hits_scalar(HitCounts *counts, const uint64_t *set, size_t words) {
+    for (size_t w = 0; w < words; w++) {
+        uint64_t bits = set[w];
+        while (bits != 0) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (counts->narrow != NULL) {
+                counts->narrow[w * WORD_BITS + bit]++;
+            }
+            else {
+                counts->wide[w * WORD_BITS + bit]++;
+            }
+        }
+    }
+}
+
+// Function for the portable score kernel
+static int score_windows_scalar(const PwmTable *pwm, const uint32_t *codes, int num_codes, uint32_t *hits, int32_t *scores) {
+    int found = 0;
+    for (int k = 0; k < num_codes; k++) {
+        int32_t score = 0;
+        uint32_t code = codes[k];
+        for (int p = 0; p < pwm->pairs; p++, code >>= 4) {
+            score += pwm->table[16 * p + (code & 15)];
+        }
+        if (score >= pwm->threshold) {
+            hits[found] = k;
+            scores[found] = score;
+            found++;
+        }
+    }
+    return found;
+}
+
+#ifdef MOTIF_X86
+// The vector kernels hold the 64 candidates in 32-bit lanes and test one substring against all
+// of them per step: XOR, fold each base's two bits together, count them per lane with a nibble
+// lookup table, compare the count with h and collect the lanes with movemask. Nothing branches
+// on the data except the check for whether every candidate has already matched.
+
+// Function for the SSSE3 kernel, 4 candidates per vector and 16 vectors per word
+__attribute__((target("ssse3")))
+static uint64_t match_word_sse(uint32_t base, uint64_t todo, const uint32_t *codes, int num_codes, int h) {
+    const __m128i lut = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i low = _mm_set1_epi32(0x55555555);
+    const __m128i ones8 = _mm_set1_epi8(1);
+    const __m128i ones16 = _mm_set1_epi16(1);
+    const __m128i limit = _mm_set1_epi32(h);
+    __m128i candidates[16];
+    for (int v = 0; v < 16; v++) {
+        candidates[v] = _mm_add_epi32(_mm_set1_epi32(base + 4 * v), _mm_setr_epi32(0, 1, 2, 3));
+    }
+
+    uint64_t found = 0;
+    for (int k = 0; k < num_codes && (found & todo) != todo; k++) {
+        __m128i code = _mm_set1_epi32(codes[k]);
+        for (int v = 0; v < 16; v++) {
+            __m128i diff = _mm_xor_si128(candidates[v], code);
+            diff = _mm_and_si128(_mm_or_si128(diff, _mm_srli_epi32(diff, 1)), low);
+            __m128i counts = _mm_add_epi8(_mm_shuffle_epi8(lut, _mm_and_si128(diff, nibble)),
+                                          _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(diff, 4), nibble)));
+            counts = _mm_madd_epi16(_mm_maddubs_epi16(counts, ones8), ones16);
+            int over = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(counts, limit)));
+            found |= (uint64_t)(~over & 0xf) << (4 * v);
+        }
+    }
+    return found & todo;
+}
+
+// Function for the AVX2 kernel, 8 candidates per vector and 8 vectors per word
+__attribute__((target("avx2")))
+static uint64_t match_word_avx2(uint32_t base, uint64_t todo, const uint32_t *codes, int num_codes, int h) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i low = _mm256_set1_epi32(0x55555555);
+    const __m256i ones8 = _mm256_set1_epi8(1);
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    const __m256i limit = _mm256_set1_epi32(h);
+    __m256i candidates[8];
+    for (int v = 0; v < 8; v++) {
+        candidates[v] = _mm256_add_epi32(_mm256_set1_epi32(base + 8 * v), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    uint64_t found = 0;
+    for (int k = 0; k < num_codes && (found & todo) != todo; k++) {
+        __m256i code = _mm256_set1_epi32(codes[k]);
+        for (int v = 0; v < 8; v++) {
+            __m256i diff = _mm256_xor_si256(candidates[v], code);
+            diff = _mm256_and_si256(_mm256_or_si256(diff, _mm256_srli_epi32(diff, 1)), low);
+            __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(diff, nibble)),
+                                             _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(diff, 4), nibble)));
+            counts = _mm256_madd_epi16(_mm256_maddubs_epi16(counts, ones8), ones16);
+            int over = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(counts, limit)));
+            found |= (uint64_t)(~over & 0xff) << (8 * v);
+        }
+    }
+    return found & todo;
+}
+
+// Function for the AVX2 hit kernel: the same lane arithmetic as match_word_avx2, with the
+// per-lane counts of any vector that has a match spilled so their distances can be recorded
+__attribute__((target("avx2")))
+static uint64_t match_word_hits_avx2(uint32_t base, uint64_t todo, const PackedString *string, int string_index, int h, Positions *positions) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i low = _mm256_set1_epi32(0x55555555);
+    const __m256i ones8 = _mm256_set1_epi8(1);
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    const __m256i limit = _mm256_set1_epi32(h);
+    __m256i candidates[8];
+    for (int v = 0; v < 8; v++) {
+        candidates[v] = _mm256_add_epi32(_mm256_set1_epi32(base + 8 * v), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    uint64_t found = 0;
+    int32_t lanes[8];
+    for (int k = 0; k < string->num_codes; k++) {
+        __m256i code = _mm256_set1_epi32(string->codes[k]);
+        for (int v = 0; v < 8; v++) {
+            __m256i diff = _mm256_xor_si256(candidates[v], code);
+            diff = _mm256_and_si256(_mm256_or_si256(diff, _mm256_srli_epi32(diff, 1)), low);
+            __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(diff, nibble)),
+                                             _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(diff, 4), nibble)));
+            counts = _mm256_madd_epi16(_mm256_maddubs_epi16(counts, ones8), ones16);
+            int over = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(counts, limit)));
+            unsigned hits = ~over & (unsigned)(todo >> (8 * v)) & 0xff;
+            if (hits != 0) {
+                _mm256_storeu_si256((__m256i *)lanes, counts);
+                found |= (uint64_t)hits << (8 * v);
+                while (hits != 0) {
+                    int lane = __builtin_ctz(hits);
+                    hits &= hits - 1;
+                    record_occurrences(positions, base + 8 * v + lane, string_index, string, k, lanes[lane]);
+                }
+            }
+        }
+    }
+    return found;
+}
+
+// Function for the AVX2 count kernel. Each 32 (or 16) bits of the set are broadcast, spread so
+// that every byte (or 16-bit lane) sees its own bit, turned into -1 where the bit is set by a
+// compare, and subtracted from the counts.
+__attribute__((target("avx2")))
+static void add_hits_avx2(HitCounts *counts, const uint64_t *set, size_t words) {
+    const __m256i spread8 = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                             2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits8 = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i bits16 = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, -32768);
+    for (size_t w = 0; w < words; w++) {
+        if (set[w] == 0) {
+            continue;
+        }
+        if (counts->narrow != NULL) {
+            for (int half = 0; half < 2; half++) {
+                uint8_t *dest = counts->narrow + w * WORD_BITS + 32 * half;
+                __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32((int)(uint32_t)(set[w] >> (32 * half))), spread8);
+                __m256i ones = _mm256_cmpeq_epi8(_mm256_and_si256(spread, bits8), bits8);
+                _mm256_storeu_si256((__m256i *)dest, _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)dest), ones));
+            }
+        }
+        else {
+            for (int quarter = 0; quarter < 4; quarter++) {
+                uint16_t *dest = counts->wide + w * WORD_BITS + 16 * quarter;
+                __m256i spread = _mm256_set1_epi16((short)(uint16_t)(set[w] >> (16 * quarter)));
+                __m256i ones = _mm256_cmpeq_epi16(_mm256_and_si256(spread, bits16), bits16);
+                _mm256_storeu_si256((__m256i *)dest, _mm256_sub_epi16(_mm256_loadu_si256((const __m256i *)dest), ones));
+            }
+        }
+    }
+}
+
+// Function for the AVX2 score kernel: 8 windows per vector, with one gather from each pair
+// table per step, the nibble for the step taken by shifting all 8 codes down 4 bits
+__attribute__((target("avx2")))
+static int score_windows_avx2(const PwmTable *pwm, const uint32_t *codes, int num_codes, uint32_t *hits, int32_t *scores) {
+    const __m256i nibble = _mm256_set1_epi32(15);
+    const __m256i below = _mm256_set1_epi32(pwm->threshold - 1);
+    int found = 0;
+    int k = 0;
+    for (; k + 8 <= num_codes; k += 8) {
+        __m256i code = _mm256_loadu_si256((const __m256i *)(codes + k));
+        __m256i score = _mm256_setzero_si256();
+        for (int p = 0; p < pwm->pairs; p++) {
+            __m256i entry = _mm256_i32gather_epi32((const int *)(pwm->table + 16 * p), _mm256_and_si256(code, nibble), 4);
+            score = _mm256_add_epi32(score, entry);
+            code = _mm256_srli_epi32(code, 4);
+        }
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(score, below)));
+        if (mask != 0) {
+            int32_t lanes[8];
+            _mm256_storeu_si256((__m256i *)lanes, score);
+            while (mask != 0) {
+                int lane = __builtin_ctz(mask);
+                mask &= mask - 1;
+                hits[found] = k + lane;
+                scores[found] = lanes[lane];
+                found++;
+            }
+        }
+    }
+    // The last few windows are scored one at a time
+    int rest = score_windows_scalar(pwm, codes + k, num_codes - k, hits + found, scores + found);
+    for (int i = found; i < found + rest; i++) {
+        hits[i] += k;
+    }
+    return found + rest;
+}
+#endif
+
+// Kernels used by motif_match_bitset and the weight matrix search, chosen once at startup by motif_select_kernel
+static MatchKernel match_word = match_word_scalar;
+static HitKernel match_word_hits = match_word_hits_scalar;
+static CountKernel add_hits = add_hits_scalar;
+ScoreKernel motif_score_windows = score_windows_scalar;
+static int kernel_chosen = 0;   // set once motif_select_kernel has picked a kernel
+static pthread_once_t default_kernel_once = PTHREAD_ONCE_INIT;
+
+// Function to pick the match kernel: the named one ("scalar", "sse" or "avx2"), or when name
+// is NULL the widest one this CPU supports. Returns 0 if the named kernel is not available.
+int motif_select_kernel(const char *name) {
+#ifdef MOTIF_X86
+    __builtin_cpu_init();
+    int have_avx2 = __builtin_cpu_supports("avx2");
+    int have_sse = __builtin_cpu_supports("ssse3");
+#else
+    int have_avx2 = 0;
+    int have_sse = 0;
+#endif
+    if (name == NULL) {
+        name = have_avx2 ? "avx2" : have_sse ? "sse" : "scalar";
+    }
+    if (strcmp(name, "scalar") == 0) {
+        match_word = match_word_scalar;
+        match_word_hits = match_word_hits_scalar;
+        add_hits = add_hits_scalar;
+        motif_score_windows = score_windows_scalar;
+        kernel_chosen = 1;
+        return 1;
+    }
+#ifdef MOTIF_X86
+    if (strcmp(name, "sse") == 0 && have_sse) {
+        match_word = match_word_sse;
+        match_word_hits = match_word_hits_scalar;   // positions and quorums are rare enough to not need SSE versions
+        add_hits = add_hits_scalar;
+        motif_score_windows = score_windows_scalar;
+        kernel_chosen = 1;
+        return 1;
+    }
+    if (strcmp(name, "avx2") == 0 && have_avx2) {
+        match_word = match_word_avx2;
+        match_word_hits = match_word_hits_avx2;
+        add_hits = add_hits_avx2;
+        motif_score_windows = score_windows_avx2;
+        kernel_chosen = 1;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// Function to get the number of input strings candidate i was found in
+int motif_hit_count(const HitCounts *counts, size_t i) {
+    return (counts->narrow != NULL) ? counts->narrow[i] : counts->wide[i];
+}
+
+// Function to zero the first num_candidates hit counts, to reuse them for another chunk
+void motif_hit_counts_clear(HitCounts *counts, size_t num_candidates) {
+    if (counts->narrow != NULL) {
+        memset(counts->narrow, 0, num_candidates * sizeof(uint8_t));
+    }
+    else {
+        memset(counts->wide, 0, num_candidates * sizeof(uint16_t));
+    }
+}
+
+// Function to build the match set of one input string from its packed substrings: bit i of
+// matches is set when candidate first + i is within h mismatches of some substring, for the
+// num_candidates candidates from first on (a multiple of 64). When mask is not
+// NULL only the candidates set in mask are tested and every other bit comes out cleared, so
+// passing the same set as mask and matches intersects it with this string in place. When
+// positions is not NULL every occurrence of every tested candidate is recorded in it as well.
+// With both_strands a candidate also matches when its reverse complement is close to a
+// substring; the substrings are only scanned as given and the set is closed afterwards, which
+// needs mask to hold the reverse complement of each of its candidates too, and the sets to
+// cover the whole candidate space.
+void motif_match_bitset(size_t first, size_t num_candidates, const PackedString *string, int string_index, int h, const uint64_t *mask, uint64_t *matches, Positions *positions, int both_strands) {
+    for (size_t w = 0; w < BITSET_WORDS(num_candidates); w++) {
+        uint64_t todo = (mask != NULL) ? mask[w] : ~(uint64_t)0;
+        if (num_candidates - w * WORD_BITS < WORD_BITS) {
+            todo &= ((uint64_t)1 << (num_candidates - w * WORD_BITS)) - 1;   // last partial word
+        }
+        if (todo == 0) {
+            matches[w] = 0;
+        }
+        else if (positions != NULL) {
+            matches[w] = match_word_hits((uint32_t)(first + w * WORD_BITS), todo, string, string_index, h, positions);
+        }
+        else {
+            matches[w] = match_word((uint32_t)(first + w * WORD_BITS), todo, string->codes, string->num_codes, h);
+        }
+    }
+    if (both_strands) {
+        close_under_reverse_complement(matches, num_candidates, __builtin_ctzll(num_candidates) / 2);   // 4^m candidates
+    }
+}
+
+// Function to order the input strings by increasing key (insertion sort, n is small)
+static void order_by_key(const size_t *key, int n, int *order) {
+    for (int j = 0; j < n; j++) {
+        int k = j;
+        while (k > 0 && key[order[k - 1]] > key[j]) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = j;
+    }
+}
+
+// Function to find motifs common to all input strings
+// The strings are intersected one at a time, most selective first, and the search stops as soon
+// as nothing survives. When match_sets holds every string's match set (as built for the per-string
+// report) the intersection is a plain AND of those sets, ordered by their exact sizes. When
+// match_sets is NULL each string instead tests only the candidates that survived the strings
+// before it, ordered by distinct substring count, starting from subset (NULL for every
+// candidate). Occurrences found along the way go into positions when it is not NULL.
+//
+// With a quorum below n the motifs found in at least quorum strings are wanted instead, and
+// counts keeps how many strings each candidate was found in. Candidates are dropped once they
+// could not reach the quorum even if they matched every string left, and the search stops
+// when no candidate can. The result is left in survivors.
+//
+// With both_strands a motif is found in a string when it or its reverse complement is. The
+// match sets, subset and survivors are then all closed under reverse complement.
+//
+// The sets cover the num_candidates candidates from first on, so the candidate space can be
+// searched one chunk at a time; chunks other than the whole space need both_strands off.
+// Working memory comes from scratch.
+size_t motif_find_motifs(size_t first, size_t num_candidates, uint64_t **match_sets, const PackedString *packed, int n, int h, const uint64_t *subset, uint64_t *survivors, Positions *positions, int quorum, HitCounts *counts, int both_strands, const SearchScratch *scratch) {
+    size_t words = BITSET_WORDS(num_candidates);
+    int *order = scratch->order;
+    size_t *key = scratch->key;
+    for (int j = 0; j < n; j++) {
+        key[j] = (match_sets != NULL) ? motif_bitset_count(match_sets[j], num_candidates)
+                                      : (size_t)count_distinct_substrings(packed[j].codes, packed[j].num_codes, scratch->sorted);
+    }
+    order_by_key(key, n, order);
+
+    if (quorum == n) {
+        for (int k = 0; k < n; k++) {
+            int j = order[k];
+            if (match_sets != NULL) {
+                for (size_t w = 0; w < words; w++) {
+                    survivors[w] = (k == 0) ? match_sets[j][w] : (survivors[w] & match_sets[j][w]);
+                }
+            }
+            else {
+                motif_match_bitset(first, num_candidates, &packed[j], j, h, (k == 0) ? subset : survivors, survivors, positions, both_strands);
+            }
+            if (motif_bitset_empty(survivors, num_candidates)) {
+                break;   // no candidate can be in all strings any more
+            }
+        }
+    }
+    else {
+        // survivors holds the candidates still able to reach the quorum, matches this string's hits
+        uint64_t *matches = scratch->matches;
+        for (size_t w = 0; w < words; w++) {
+            survivors[w] = (subset != NULL) ? subset[w] : ~(uint64_t)0;
+        }
+        for (int k = 0; k < n; k++) {
+            int j = order[k];
+            if (match_sets != NULL) {
+                for (size_t w = 0; w < words; w++) {
+                    matches[w] = survivors[w] & match_sets[j][w];
+                }
+            }
+            else {
+                motif_match_bitset(first, num_candidates, &packed[j], j, h, survivors, matches, positions, both_strands);
+            }
+            add_hits(counts, matches, words);
+
+            // A candidate missed by this string is out once even the n-k-1 strings left cannot
+            // lift it to the quorum; only the candidates that just missed need checking
+            int left = n - k - 1;
+            int alive = 0;
+            for (size_t w = 0; w < words; w++) {
+                uint64_t missed = survivors[w] & ~matches[w];
+                while (missed != 0) {
+                    int bit = __builtin_ctzll(missed);
+                    missed &= missed - 1;
+                    if (motif_hit_count(counts, w * WORD_BITS + bit) + left < quorum) {
+                        survivors[w] &= ~((uint64_t)1 << bit);
+                    }
+                }
+                alive |= (survivors[w] != 0);
+            }
+            if (!alive) {
+                break;   // no candidate can reach the quorum any more
+            }
+        }
+        // Every survivor satisfied count + left >= quorum when it last missed and has matched
+        // every string since, so once all strings are seen the survivors are exactly the result
+    }
+
+    return motif_bitset_count(survivors, num_candidates); // Return the number of motifs found
+}
+
+// Everything a context keeps between searches. Buffers only ever grow, so repeated searches of
+// similar size allocate nothing after the first.
+struct MotifContext {
+    uint64_t *survivors;        // candidates still in the running
+    size_t survivor_words;      // words allocated in survivors
+    uint64_t *matches;          // one string's matches, for quorum searches only
+    size_t match_words;         // words allocated in matches
+    uint8_t *narrow;            // per-candidate string counts for quorum searches, n <= 255
+    size_t narrow_capacity;     // counters allocated in narrow
+    uint16_t *wide;             // the same when n is larger
+    size_t wide_capacity;       // counters allocated in wide
+    Substring *substrings;
+    uint32_t *codes;            // packed windows of every string, rows of l - m + 1
+    uint32_t *sorted;
+    size_t code_capacity;       // codes allocated in codes
+    int row_capacity;           // codes allocated in sorted and substrings
+    PackedString *packed;
+    int *order;
+    size_t *key;
+    int string_capacity;        // strings allocated in packed, order and key
+};
+
+// Function to pick the widest kernel, unless the program picked one already
+static void select_default_kernel(void) {
+    if (!kernel_chosen) {
+        motif_select_kernel(NULL);
+    }
+}
+
+// Function to create a search context, or NULL if it could not be allocated. The kernel is
+// picked once per process, and every context is created after that has finished, so searches
+// on other threads never see the kernel pointers change.
+MotifContext *motif_context_create(void) {
+    pthread_once(&default_kernel_once, select_default_kernel);
+    return (MotifContext *)calloc(1, sizeof(MotifContext));
+}
+
+// Function to make sure a context can search n strings of l bases for motifs of length m, with
+// per-candidate counters when counting (a quorum below n). Only what this search uses is grown.
+// Returns 0 if memory ran out; whatever was grown stays with the context either way.
+static int motif_reserve(MotifContext *context, int n, int l, int m, int counting) {
+    int failed = 0;
+    size_t num_candidates = (size_t)1 << (2 * m);
+    size_t words = BITSET_WORDS(num_candidates);
+    int row = l - m + 1;   // canonical codes replace the windows in place, so one row per string
+    if (words > context->survivor_words) {
+        context->survivors = (uint64_t *)grow_array(context->survivors, words, sizeof(uint64_t), &failed);
+        if (!failed) {
+            context->survivor_words = words;
+        }
+    }
+    if (counting && words > context->match_words) {
+        context->matches = (uint64_t *)grow_array(context->matches, words, sizeof(uint64_t), &failed);
+        if (!failed) {
+            context->match_words = words;
+        }
+    }
+    // One byte per counter when n fits in one, as the command line program does
+    if (counting && n <= UINT8_MAX && num_candidates > context->narrow_capacity) {
+        context->narrow = (uint8_t *)grow_array(context->narrow, num_candidates, sizeof(uint8_t), &failed);
+        if (!failed) {
+            context->narrow_capacity = num_candidates;
+        }
+    }
+    if (counting && n > UINT8_MAX && num_candidates > context->wide_capacity) {
+        context->wide = (uint16_t *)grow_array(context->wide, num_candidates, sizeof(uint16_t), &failed);
+        if (!failed) {
+            context->wide_capacity = num_candidates;
+        }
+    }
+    if ((size_t)n * row > context->code_capacity) {
+        context->codes = (uint32_t *)grow_array(context->codes, (size_t)n * row, sizeof(uint32_t), &failed);
+        if (!failed) {
+            context->code_capacity = (size_t)n * row;
+        }
+    }
+    if (row > context->row_capacity) {
+        context->sorted = (uint32_t *)grow_array(context->sorted, row, sizeof(uint32_t), &failed);
+        context->substrings = (Substring *)grow_array(context->substrings, row, sizeof(Substring), &failed);
+        if (!failed) {
+            context->row_capacity = row;
+        }
+    }
+    if (n > context->string_capacity) {
+        context->packed = (PackedString *)grow_array(context->packed, n, sizeof(PackedString), &failed);
+        context->order = (int *)grow_array(context->order, n, sizeof(int), &failed);
+        context->key = (size_t *)grow_array(context->key, n, sizeof(size_t), &failed);
+        if (!failed) {
+            context->string_capacity = n;
+        }
+    }
+    return !failed;
+}
+
+// Function to find the motifs of length m within h mismatches of a window in at least quorum
+// of the n sequences, each l bases long. Returns MOTIF_OK or an error code.
+int motif_search(MotifContext *context, const char *const *sequences, int n, int l, const MotifParams *params, MotifResult *result) {
+    int m = params->m;
+    int h = params->h;
+    int quorum = (params->quorum == 0) ? n : params->quorum;
+    result->count = 0;
+    if (n < 1 || n > MAX_N || l < MIN_L || l > MAX_L || m < MIN_M || m > MAX_M || m > l
+        || h < 0 || h > m || quorum < 1 || quorum > n) {
+        return MOTIF_ERROR_PARAMS;
+    }
+    for (int i = 0; i < n; i++) {
+        if (strspn(sequences[i], "ACGT") < (size_t)l) {
+            return MOTIF_ERROR_INPUT;
+        }
+    }
+    if (!motif_reserve(context, n, l, m, quorum < n)) {
+        return MOTIF_ERROR_MEMORY;
+    }
+
+    // Pack every string; a two-strand search compares canonical codes and closes the matches
+    size_t num_candidates = (size_t)1 << (2 * m);
+    int row = l - m + 1;
+    int num_substrings;
+    motif_gen_substrings(l, m, context->substrings, &num_substrings);
+    for (int i = 0; i < n; i++) {
+        uint32_t *codes = context->codes + (size_t)i * row;
+        motif_pack_substrings(sequences[i], context->substrings, num_substrings, m, codes);
+        context->packed[i].codes = codes;
+        context->packed[i].num_codes = params->both_strands ? motif_canonical_substrings(codes, num_substrings, m) : num_substrings;
+        context->packed[i].starts = NULL;
+        context->packed[i].positions = NULL;
+    }
+
+    HitCounts quorum_counts = {(n <= UINT8_MAX) ? context->narrow : NULL, (n <= UINT8_MAX) ? NULL : context->wide};
+    HitCounts *counts = NULL;
+    if (quorum < n) {
+        counts = &quorum_counts;
+        motif_hit_counts_clear(counts, num_candidates);
+    }
+    SearchScratch scratch = {context->order, context->key, context->sorted, context->matches};
+    size_t found = motif_find_motifs(0, num_candidates, NULL, context->packed, n, h, NULL, context->survivors, NULL,
+                               quorum, counts, params->both_strands, &scratch);
+
+    // Hand the motifs over in ascending order, as many as fit
+    for (size_t w = 0; w < BITSET_WORDS(num_candidates); w++) {
+        uint64_t bits = context->survivors[w];
+        while (bits != 0 && result->count < result->capacity) {
+            size_t i = w * WORD_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            result->motifs[result->count] = (uint32_t)i;
+            if (result->strings != NULL) {
+                result->strings[result->count] = (counts != NULL) ? motif_hit_count(counts, i) : n;
+            }
+            result->count++;
+        }
+    }
+    result->count = found;
+    return (found > result->capacity) ? MOTIF_ERROR_SPACE : MOTIF_OK;
+}
+
+// Function to write packed motif code of length m into motif as m letters and a terminator
+void motif_decode(uint32_t code, int m, char *motif) {
+    motif_gen_candidate(code, m, motif);
+}
+
+// Function to describe an error code
+const char *motif_strerror(int error) {
+    switch (error) {
+        case MOTIF_OK:           return "success";
+        case MOTIF_ERROR_MEMORY: return "memory allocation failed";
+        case MOTIF_ERROR_PARAMS: return "parameters out of range";
+        case MOTIF_ERROR_INPUT:  return "sequence holds a character other than A, C, G and T";
+        case MOTIF_ERROR_SPACE:  return "more motifs found than the result buffers hold";
+        default:                 return "unknown error";
+    }
+}
+
+// Function to release a context and all its working memory
+void motif_context_free(MotifContext *context) {
+    if (context == NULL) {
+        return;
+    }
+    free(context->survivors);
+    free(context->matches);
+    free(context->narrow);
+    free(context->wide);
+    free(context->substrings);
+    free(context->codes);
+    free(context->sorted);
+    free(context->packed);
+    free(context->order);
+    free(context->key);
+    free(context);
+}
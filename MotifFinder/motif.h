@@ -0,0 +1,61 @@
+#ifndef MOTIF_H
+#define MOTIF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libmotif: the motif search engine of the motif finder, for programs that embed it. A context
+// owns all working memory, which is kept and reused from one search to the next; results go
+// into buffers the caller provides. Nothing in the library prints or exits: every failure is
+// returned as an error code.
+
+// Error codes returned by motif_search
+#define MOTIF_OK            0
+#define MOTIF_ERROR_MEMORY  1   // working memory could not be allocated
+#define MOTIF_ERROR_PARAMS  2   // n, l, m, h or quorum out of range
+#define MOTIF_ERROR_INPUT   3   // a sequence holds something other than A, C, G and T
+#define MOTIF_ERROR_SPACE   4   // more motifs were found than the result buffers hold
+
+// Input limits of motif_search
+#define MOTIF_MAX_N         1024    // sequences
+#define MOTIF_MIN_L         8       // bases per sequence
+#define MOTIF_MAX_L         1000000
+#define MOTIF_MIN_M         3       // motif length
+#define MOTIF_MAX_M         16
+
+typedef struct MotifContext MotifContext;
+
+// What to search for
+typedef struct {
+    int m;                      // motif length
+    int h;                      // mismatches allowed between a motif and a window
+    int quorum;                 // strings a motif must be found in; 0 means all of them
+    int both_strands;           // also count a motif where its reverse complement occurs
+} MotifParams;
+
+// Where the motifs found go
+typedef struct {
+    uint32_t *motifs;           // packed motifs found, ascending (decode with motif_decode)
+    uint16_t *strings;          // NULL, or how many strings each motif was found in
+    size_t capacity;            // entries the buffers have room for
+    size_t count;               // motifs found; set even when they did not all fit
+} MotifResult;
+
+// Function to create a search context, or NULL if it could not be allocated. Contexts may be
+// created and used from several threads, one context per thread at a time.
+MotifContext *motif_context_create(void);
+
+// Function to find the motifs of length m within h mismatches of a window in at least quorum
+// of the n sequences, each l bases long. Returns MOTIF_OK or an error code.
+int motif_search(MotifContext *context, const char *const *sequences, int n, int l, const MotifParams *params, MotifResult *result);
+
+// Function to write packed motif code of length m into motif as m letters and a terminator
+void motif_decode(uint32_t code, int m, char *motif);
+
+// Function to describe an error code
+const char *motif_strerror(int error);
+
+// Function to release a context and all its working memory
+void motif_context_free(MotifContext *context);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef MOTIF_INTERNAL_H
+#define MOTIF_INTERNAL_H
+
+#include "motif.h"
+
+// The engine underneath libmotif, shared with the command line program but not part of the
+// library's interface: kernels, packing, bitsets and the search itself.
+
+// Input limits. Sequences live in one flat buffer and candidates are never stored, so
+// these are bounded by search time rather than by per-string allocations.
+#define MIN_N 2
+#define MAX_N MOTIF_MAX_N
+#define MIN_L MOTIF_MIN_L
+#define MAX_L MOTIF_MAX_L
+#define MIN_M MOTIF_MIN_M
+#define MAX_M MOTIF_MAX_M
+
+// Match sets are bitsets over the motif space: bit i of a set stands for candidate number i.
+#define WORD_BITS 64
+#define BITSET_WORDS(bits) (((bits) + WORD_BITS - 1) / WORD_BITS)
+
+// A substring is a zero-copy window into its input string.
+typedef struct {
+    int offset;     // index of the first character in the input string
+    int length;     // number of characters in the window (always m)
+} Substring;
+
+// The packed substrings an input string is matched against: every window in order, or with a
+// k-mer index only the distinct ones, along with where each of them occurs.
+typedef struct {
+    const uint32_t *codes;      // 2-bit packed substrings
+    int num_codes;
+    const uint32_t *starts;     // index only: codes[k] occurs at positions[starts[k]] .. positions[starts[k+1]-1]
+    const uint32_t *positions;  // index only; NULL when codes[k] is simply the window at offset k
+} PackedString;
+
+// Motif occurrences (every window within h mismatches of a candidate) kept column by column,
+// so each field is one dense array that can be written out or scanned on its own.
+typedef struct {
+    size_t count;
+    size_t capacity;
+    uint32_t *motif;            // candidate number, i.e. the packed motif
+    uint32_t *string;           // input string, from 0
+    uint32_t *offset;           // start of the window in the input string, from 0
+    uint8_t *distance;          // mismatches between motif and window
+    uint8_t *strand;            // 0 when the motif is on the given strand, 1 on its reverse complement
+    int both_strands;           // also record each hit's reverse complement on the other strand
+    int m;                      // motif length, to take reverse complements
+    int failed;                 // set when the columns could not grow; later occurrences are dropped
+} Positions;
+
+// Per-candidate counts of the input strings each motif was found in, for quorum searches.
+// One byte per candidate when n fits in one, two otherwise; exactly one of the arrays is used.
+typedef struct {
+    uint8_t *narrow;
+    uint16_t *wide;
+} HitCounts;
+
+// A position weight matrix, kept as lookup tables over pairs of positions: entry b of table p
+// is the summed log-odds score of the two bases packed in the 4 bits b at positions 2p and
+// 2p+1. A window's score is then one lookup per two bases of its packed code. Scores are fixed
+// point in thousandths, so the sums are exact and the vector kernels can use integer lanes.
+// Scores are limited so that a whole window, MAX_M of them summed, still fits in 32 bits.
+#define PWM_SCALE 1000
+#define PWM_PAIRS ((MAX_M + 1) / 2)
+#define PWM_MAX_SCORE 100000.0
+#define PWM_MAX_THRESHOLD (PWM_MAX_SCORE * MAX_M)
+
+typedef struct {
+    int m;                      // number of positions
+    int pairs;                  // tables in use, (m + 1) / 2
+    int32_t threshold;          // windows scoring at least this are hits
+    int32_t table[PWM_PAIRS * 16];
+} PwmTable;
+
+// Working memory for motif_find_motifs: order and key hold n entries, sorted the largest number of
+// codes of any string, and matches (only used with a quorum) a bitset over the candidates.
+typedef struct {
+    int *order;
+    size_t *key;
+    uint32_t *sorted;
+    uint64_t *matches;
+} SearchScratch;
+
+// Score kernels score every packed window against a weight matrix and collect the windows
+// reaching its threshold: their numbers go to hits and their scores to scores. Returns how many.
+typedef int (*ScoreKernel)(const PwmTable *pwm, const uint32_t *codes, int num_codes, uint32_t *hits, int32_t *scores);
+
+// Score kernel in use, chosen with the match kernels by motif_select_kernel. The command line
+// program picks them before searching; otherwise the first motif_context_create picks the
+// widest, once for the whole process.
+extern ScoreKernel motif_score_windows;
+
+int motif_select_kernel(const char *name);
+int motif_bitset_test(const uint64_t *set, size_t i);
+size_t motif_bitset_count(const uint64_t *set, size_t bits);
+int motif_bitset_empty(const uint64_t *set, size_t bits);
+void motif_gen_candidate(size_t id, int m, char *motif);
+void motif_gen_substrings(int l, int m, Substring *substrings, int *num_substrings);
+uint32_t motif_encode_substring(const char *str, int m);
+uint32_t motif_reverse_complement(uint32_t code, int m);
+void motif_pack_substrings(const char *input_string, Substring *substrings, int num_substrings, int m, uint32_t *codes);
+int motif_canonical_substrings(uint32_t *codes, int num_codes, int m);
+int motif_both_strand_substrings(uint32_t *codes, int num_codes, int m);
+int motif_hit_count(const HitCounts *counts, size_t i);
+void motif_hit_counts_clear(HitCounts *counts, size_t num_candidates);
+void motif_match_bitset(size_t first, size_t num_candidates, const PackedString *string, int string_index, int h, const uint64_t *mask, uint64_t *matches, Positions *positions, int both_strands);
+size_t motif_find_motifs(size_t first, size_t num_candidates, uint64_t **match_sets, const PackedString *packed, int n, int h, const uint64_t *subset, uint64_t *survivors, Positions *positions, int quorum, HitCounts *counts, int both_strands, const SearchScratch *scratch);
+
+#endif
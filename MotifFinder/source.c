@@ -1,250 +1,1483 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "motif_internal.h"
+
+// Header of a packed binary positions file, followed by the motif, string and offset columns
+// (count 32-bit values each) and the distance and strand columns (count bytes each)
+typedef struct {
+    char magic[4];              // "MPOS"
+    uint32_t m;
+    uint32_t h;
+    uint32_t n;
+    uint64_t count;
+} PositionsHeader;
+
+// Output levels: quiet prints only the number of common motifs, summary adds per-string
+// counts and the common motifs, full also lists every candidate and substring.
+#define LEVEL_QUIET   0
+#define LEVEL_SUMMARY 1
+#define LEVEL_FULL    2
+
+// A k-mer index holds, for every input string, its distinct m-mers as a sorted packed array
+// with the offsets each one occurs at, so later queries with any h skip reading and packing the
+// strings and only compare each distinct m-mer once. The file is laid out as
+//   IndexHeader | n IndexSequence entries | n*l characters of input strings | per string:
+//   kmers (num_kmers codes), starts (num_kmers+1 positions), positions (num_positions offsets)
+// with every section 8-byte aligned, and is memory-mapped when queried.
+#define INDEX_VERSION 1
+
+typedef struct {
+    char magic[4];              // "MIDX"
+    uint32_t version;
+    uint32_t n;
+    uint32_t l;
+    uint32_t m;
+    uint32_t reserved;
+    uint64_t sequences;         // file offset of the input strings
+} IndexHeader;
+
+typedef struct {
+    uint64_t kmers;             // file offset of the sorted distinct codes
+    uint64_t starts;            // file offset of the occurrence list starts
+    uint64_t positions;         // file offset of the occurrence offsets
+    uint32_t num_kmers;
+    uint32_t num_positions;
+} IndexSequence;
+
+typedef struct {
+    char *map;                  // the whole file, mapped read-only
+    size_t size;
+    const IndexHeader *header;
+    const IndexSequence *table;
+} Index;
+
+// Results file formats
+#define FORMAT_TSV 0
+#define FORMAT_BIN 1
+
+// Listings are collected in one large buffer and handed to write() when it fills up,
+// instead of going through printf one token at a time.
+#define OUTPUT_SIZE (1 << 20)
+
+typedef struct {
+    int fd;                     // descriptor the buffer is flushed to
+    size_t len;                 // bytes currently buffered
+    char data[OUTPUT_SIZE];
+} Output;
+
+// Header of a packed binary results file, followed by count 32-bit motif codes
+typedef struct {
+    char magic[4];              // "MOTF"
+    uint32_t m;
+    uint32_t h;
+    uint32_t n;
+    uint64_t count;
+} ResultsHeader;
+
+// A session keeps a finished search so that strings arriving later only cost one pass each.
+// The file is laid out as
+//   SessionHeader | survivors (4^m bits, in 64-bit words) | n*l characters of input strings
+// and new strings go at its end, so an append rewrites only the header and the survivors.
+#define SESSION_VERSION 1
+
+typedef struct {
+    char magic[4];              // "MSES"
+    uint32_t version;
+    uint32_t n;
+    uint32_t l;
+    uint32_t m;
+    uint32_t h;
+    uint32_t both_strands;
+    uint32_t reserved;
+    uint64_t count;             // motifs found in all n strings
+} SessionHeader;
+
+// Function to read one integer. A token that is not a number reads as -1, which fails every
+// range check, and running out of input ends the program instead of prompting forever.
+void read_int(int *value) {
+    int result = scanf("%d", value);
+    if (result == EOF) {
+        fprintf(stderr, "Unexpected end of input\n");
+        exit(1);
+    }
+    if (result == 0) {
+        scanf("%*s");
+        *value = -1;
+    }
+}
+
+// Function to read the number of allowable mismatches for motifs of length m
+void read_mismatches(int *h, int m, int prompt) {
+    do {
+        if (prompt) printf("Please enter the number of allowable mismatches (h): "); // number of allowed mismatches between the motifs.
+        read_int(h);
+    } while (*h < 0 || *h > m);
+}
+
+// Function to read n input strings of length l. They are numbered from first + 1 in the prompts.
+void read_strings(char ***dna_strings, int n, int l, int first, int prompt) {
+    // Allocate the row pointers and one contiguous block holding every string back to back.
+    // Each row has room for one extra character so an over-long entry fails the length check
+    // instead of overflowing into the next string.
+    *dna_strings = (char **)malloc(n * sizeof(char *));
+    char *block = (char *)malloc((size_t)n * (l + 2) * sizeof(char));
+    if (*dna_strings == NULL || block == NULL) {
+        printf("Memory allocation failed\n");   // checking if memeory allocating worked.
+        exit(1);
+    }
+    char format[16];
+    sprintf(format, "%%%ds", l + 1);   // bounded conversion so scanf never writes past the row
+    for (int i = 0; i < n; i++) {
+        (*dna_strings)[i] = block + (size_t)i * (l + 2);
+        do {
+            if (prompt) printf("Please enter input string #%d: ", first + i + 1);                 // entering each indvidual string into the 2d array
+            if (scanf(format, (*dna_strings)[i]) == EOF) {
+                fprintf(stderr, "Unexpected end of input\n");
+                exit(1);
+            }
+            if(strlen((*dna_strings)[i]) != l || strspn((*dna_strings)[i], "ACGT") != l){  // adding input to 2d array col we derference the ith index of the 2d array to store the input there
+                printf("Invalid input! \n");
+            }
+        } while (strlen((*dna_strings)[i]) != l || strspn((*dna_strings)[i], "ACGT") != l);  // check condition that will keep loop going as long as string lenght
+        //entered is not equal to length of string inputed before and we dereference l to compared the value at l to teh string lenght of the ith index of the 2d array and
+        // we are comparing the letter at the ith index and if they contain ACGT and if it does not equal to the lenght of l we keep looping until we break these condiditions
+    }
+}
 
 // Function for user input
-void user_input(int *n, int *l, int *m, int *h, char ***dna_strings) {
+// Prompts are skipped when prompt is 0 (non-interactive quiet or summary runs). h may be NULL
+// when it is not needed, as for an index build.
+void user_input(int *n, int *l, int *m, int *h, char ***dna_strings, int prompt) {
     do {
-        printf("Please enter the number of input strings for motif search (n): "); // Number of strings
-        scanf("%d", n);
-    } while (*n < 2 || *n > 8);
+        if (prompt) printf("Please enter the number of input strings for motif search (n): "); // Number of strings
+        read_int(n);
+    } while (*n < MIN_N || *n > MAX_N);
 
     do {
-        printf("Please enter the length of each input string (l): ");   // length of each input string
-        scanf("%d", l);
-            if (*l< 8 || *l > 16) {
+        if (prompt) printf("Please enter the length of each input string (l): ");   // length of each input string
+        read_int(l);
+            if (*l < MIN_L || *l > MAX_L) {
         printf("Invalid input!\n");
     }
-    } while (*l < 8 || *l > 16);
+    } while (*l < MIN_L || *l > MAX_L);
 
     do {
-        printf("Please enter the length of motifs (m): ");  // lenght of the motifs so the substrings of each string that where looking for in the dna sequence.
-        scanf("%d", m);
-    } while (*m < 3 || *m > 5);
+        if (prompt) printf("Please enter the length of motifs (m): ");  // lenght of the motifs so the substrings of each string that where looking for in the dna sequence.
+        read_int(m);
+    } while (*m < MIN_M || *m > MAX_M || *m > *l);
 
-    do {
-        printf("Please enter the number of allowable mismatches (h): "); // number of allowed mismatches between the motifs.
-        scanf("%d", h);
-    } while (*h < 0 || *h > 2);
+    if (h != NULL) {
+        read_mismatches(h, *m, prompt);
+    }
 
-    // Allocate memory for dna_strings
-    *dna_strings = (char **)malloc(*n * sizeof(char *));   // allocating memeory for the 2d array to store the dna strings inputed by the user.
-    if (*dna_strings == NULL) { 
-        printf("Memory allocation failed\n");   // checking if memeory allocating worked.
+    read_strings(dna_strings, *n, *l, 0, prompt);
+}
+
+// Function to allocate a cleared bitset with room for bits bits
+uint64_t *bitset_alloc(size_t bits) {
+    uint64_t *set = (uint64_t *)calloc(BITSET_WORDS(bits), sizeof(uint64_t));
+    if (set == NULL) {
+        printf("Memory allocation failed\n");
         exit(1);
     }
-    for (int i = 0; i < *n; i++) {                                      // allocating memeory for cols of 2d array
-        (*dna_strings)[i] = (char *)malloc((*l + 1) * sizeof(char));
-        if ((*dna_strings)[i] == NULL) {                // checking if memeory allocating worked
-            printf("Memory allocation failed\n");
+    return set;
+}
+
+// Function to create an output buffer for a file descriptor
+Output *output_open(int fd) {
+    Output *out = (Output *)malloc(sizeof(Output));
+    if (out == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    out->fd = fd;
+    out->len = 0;
+    return out;
+}
+
+// Function to write everything buffered so far
+void output_flush(Output *out) {
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t written = write(out->fd, out->data + done, out->len - done);
+        if (written < 0) {
+            perror("write");
             exit(1);
         }
-        do {
-            printf("Please enter input string #%d: ", i + 1);                 // entering each indvidual string into the 2d array
-            scanf("%s", (*dna_strings)[i]); 
-            if(strlen((*dna_strings)[i]) != *l || strspn((*dna_strings)[i], "ACGT") != *l){  // adding input to 2d array col we derference the ith index of the 2d array to store the input there
-                printf("Invalid input! \n");
-            }  
-        } while (strlen((*dna_strings)[i]) != *l || strspn((*dna_strings)[i], "ACGT") != *l);  // check condition that will keep loop going as long as string lenght
-        //entered is not equal to length of string inputed before and we dereference l to compared the value at l to teh string lenght of the ith index of the 2d array and
-        // we are comparing the letter at the ith index and if they contain ACGT and if it does not equal to the lenght of l we keep looping until we break these condiditions
+        done += written;
+    }
+    out->len = 0;
+}
+
+// Function to append bytes to an output buffer
+void output_bytes(Output *out, const void *bytes, size_t len) {
+    if (out->len + len > OUTPUT_SIZE) {
+        output_flush(out);
+    }
+    while (len > OUTPUT_SIZE) {   // larger than the whole buffer, pass it through in pieces
+        memcpy(out->data, bytes, OUTPUT_SIZE);
+        out->len = OUTPUT_SIZE;
+        output_flush(out);
+        bytes = (const char *)bytes + OUTPUT_SIZE;
+        len -= OUTPUT_SIZE;
+    }
+    memcpy(out->data + out->len, bytes, len);
+    out->len += len;
+}
+
+// Function to append formatted text to an output buffer
+void output_printf(Output *out, const char *format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    output_bytes(out, line, (len < (int)sizeof(line)) ? len : (int)sizeof(line) - 1);
+}
+
+// Function to flush and release an output buffer
+void output_close(Output *out) {
+    output_flush(out);
+    free(out);
+}
+
+// Function to display the candidate motifs
+// Only the candidates set in subset are listed, or all of them when subset is NULL.
+void gen_candidates(Output *out, size_t num_candidates, int m, const uint64_t *subset) {
+    char motif[MAX_M + 2];
+
+    // Display all candidates
+    output_printf(out, "All candidate motifs for m=%d are as follows:\n", m);
+
+    size_t listed = 0;
+    for (size_t i = 0; i < num_candidates; i++) {      // for loop to print out candidates.
+        if (subset != NULL && !motif_bitset_test(subset, i)) {
+            continue;
+        }
+        motif_gen_candidate(i, m, motif);
+        motif[m] = ' ';
+        output_bytes(out, motif, m + 1);
+        if (++listed % 8 == 0) {
+            output_bytes(out, "\n", 1);
+        }
     }
+    output_bytes(out, "\n", 1);
 }
 
-// Function to generate candidate motifs
-void gen_candidates(char ***candidates, int m) {    // pass paramteres into the function we are passing a pointer to a 2d array which is a pointer to a pointer to a pointer
-    char bases[] = "ACGT";              // are base characters for the motifs
-    int total_combinations = (int)pow(4, m);    // total number of combintations formula 
-    *candidates = (char **)malloc(total_combinations * sizeof(char *));  // indital dynamic array to store all possible canadites and we are intialzing the size of the array to
-    // be the total combinations 
-    
-    if (*candidates == NULL) {
-        printf("Memory allocation failed\n");  // checking if memory allocationg actaully worked
+// Function to display the substrings of one input string
+void print_substrings(Output *out, char *input_string, Substring *substrings, int num_substrings, int m, int string_index) {
+    output_printf(out, "All substrings of length %d from input string #%d are as follows:\n", m, string_index + 1);
+
+    for (int i = 0; i < num_substrings; i++) {    // looping through all substring and printing them out
+        output_bytes(out, input_string + substrings[i].offset, substrings[i].length);   // prints ith window straight out of the input string.
+        output_bytes(out, " ", 1);
+    }
+    output_bytes(out, "\n", 1);
+}
+
+// Function to create an empty positions table for motifs of length m
+Positions *positions_alloc(int m, int both_strands) {
+    Positions *positions = (Positions *)calloc(1, sizeof(Positions));
+    if (positions == NULL) {
+        printf("Memory allocation failed\n");
         exit(1);
     }
-    
-    for (int i = 0; i < total_combinations; i++) {
-        (*candidates)[i] = (char *)malloc((m + 1) * sizeof(char));    // allocating memeory for the columns of the 2d array which are going to store all teh combintations
-        // the base array is holds all the pointers poitnign the the subaray teh columns 
-        if ((*candidates)[i] == NULL) {   // checking if the memeory allocation worked.
-            printf("Memory allocation failed\n");
-            exit(1);
+    positions->m = m;
+    positions->both_strands = both_strands;
+    return positions;
+}
+
+// Function to release a positions table
+void positions_free(Positions *positions) {
+    free(positions->motif);
+    free(positions->string);
+    free(positions->offset);
+    free(positions->distance);
+    free(positions->strand);
+    free(positions);
+}
+
+// Function to create zeroed hit counts for num_candidates candidates and n input strings
+HitCounts *hit_counts_alloc(size_t num_candidates, int n) {
+    HitCounts *counts = (HitCounts *)calloc(1, sizeof(HitCounts));
+    if (counts != NULL && n <= UINT8_MAX) {
+        counts->narrow = (uint8_t *)calloc(num_candidates, sizeof(uint8_t));
+    }
+    else if (counts != NULL) {
+        counts->wide = (uint16_t *)calloc(num_candidates, sizeof(uint16_t));
+    }
+    if (counts == NULL || (counts->narrow == NULL && counts->wide == NULL)) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    return counts;
+}
+
+// Function to allocate working memory for motif_find_motifs over n strings of at most max_codes
+// packed substrings each and num_candidates candidates, with a matches set when counting
+SearchScratch *search_scratch_alloc(int n, int max_codes, size_t num_candidates, int counting) {
+    SearchScratch *scratch = (SearchScratch *)calloc(1, sizeof(SearchScratch));
+    if (scratch == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    scratch->order = (int *)malloc(n * sizeof(int));
+    scratch->key = (size_t *)malloc(n * sizeof(size_t));
+    scratch->sorted = (uint32_t *)malloc(max_codes * sizeof(uint32_t));
+    scratch->matches = counting ? bitset_alloc(num_candidates) : NULL;
+    if (scratch->order == NULL || scratch->key == NULL || scratch->sorted == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    return scratch;
+}
+
+// Function to release motif_find_motifs working memory
+void search_scratch_free(SearchScratch *scratch) {
+    free(scratch->order);
+    free(scratch->key);
+    free(scratch->sorted);
+    free(scratch->matches);
+    free(scratch);
+}
+
+// Function to release hit counts
+void hit_counts_free(HitCounts *counts) {
+    free(counts->narrow);
+    free(counts->wide);
+    free(counts);
+}
+
+// Function to round a file offset up to the next 8-byte boundary
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Function to append zero bytes up to an 8-byte boundary
+void output_pad(Output *out, uint64_t *offset) {
+    static const char zeros[8] = {0};
+    uint64_t aligned = align8(*offset);
+    output_bytes(out, zeros, aligned - *offset);
+    *offset = aligned;
+}
+
+// Function to compare two (code, offset) pairs for qsort
+int compare_occurrences(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to build a k-mer index of the input strings and write it to filename
+void build_index(const char *filename, char **dna_strings, int n, int l, int m) {
+    int num_positions = l - m + 1;
+    Substring *substrings = (Substring *)malloc(num_positions * sizeof(Substring));
+    uint32_t *codes = (uint32_t *)malloc(num_positions * sizeof(uint32_t));
+    uint64_t *occurrences = (uint64_t *)malloc(num_positions * sizeof(uint64_t));
+    IndexSequence *table = (IndexSequence *)calloc(n, sizeof(IndexSequence));
+    uint32_t *kmers = (uint32_t *)malloc((size_t)n * num_positions * sizeof(uint32_t));
+    uint32_t *starts = (uint32_t *)malloc((size_t)n * (num_positions + 1) * sizeof(uint32_t));
+    uint32_t *positions = (uint32_t *)malloc((size_t)n * num_positions * sizeof(uint32_t));
+    if (substrings == NULL || codes == NULL || occurrences == NULL || table == NULL || kmers == NULL || starts == NULL || positions == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+
+    // Group every string's windows by code: sorting (code, offset) pairs gives the distinct
+    // codes in order and each one's offsets ascending, ready to be cut into occurrence lists
+    uint64_t offset = align8(sizeof(IndexHeader) + n * sizeof(IndexSequence));
+    IndexHeader header = {{'M', 'I', 'D', 'X'}, INDEX_VERSION, n, l, m, 0, offset};
+    offset = align8(offset + (uint64_t)n * l);
+    int num_substrings;
+    motif_gen_substrings(l, m, substrings, &num_substrings);
+    for (int i = 0; i < n; i++) {
+        uint32_t *seq_kmers = kmers + (size_t)i * num_positions;
+        uint32_t *seq_starts = starts + (size_t)i * (num_positions + 1);
+        uint32_t *seq_positions = positions + (size_t)i * num_positions;
+        motif_pack_substrings(dna_strings[i], substrings, num_substrings, m, codes);
+        for (int k = 0; k < num_substrings; k++) {
+            occurrences[k] = ((uint64_t)codes[k] << 32) | substrings[k].offset;
         }
-        int idx = i;   //putting the idx varible equal to current motif number.
-        for (int j = 0; j < m; j++) {   // looping through the length of m which is the lenght of the motifs
-            (*candidates)[i][j] = bases[idx % 4];   // derefernceing the elements of teh 2d array and makign them equal to base array which holds the ACGT Letters 
-            // and module operating them by 4 to get number between 1-3 to get one of the letters.
-            idx /= 4; // divide by for to get the next digit.
+        qsort(occurrences, num_substrings, sizeof(uint64_t), compare_occurrences);
+        uint32_t distinct = 0;
+        for (int k = 0; k < num_substrings; k++) {
+            uint32_t code = (uint32_t)(occurrences[k] >> 32);
+            if (k == 0 || code != seq_kmers[distinct - 1]) {
+                seq_kmers[distinct] = code;
+                seq_starts[distinct] = k;
+                distinct++;
+            }
+            seq_positions[k] = (uint32_t)occurrences[k];
         }
-        (*candidates)[i][m] = '\0';  //putting null terminatior at the end of the string .
+        seq_starts[distinct] = num_substrings;
+
+        table[i].num_kmers = distinct;
+        table[i].num_positions = num_substrings;
+        table[i].kmers = offset;
+        offset = align8(offset + distinct * sizeof(uint32_t));
+        table[i].starts = offset;
+        offset = align8(offset + (distinct + 1) * sizeof(uint32_t));
+        table[i].positions = offset;
+        offset = align8(offset + num_substrings * sizeof(uint32_t));
     }
 
-    // Display all candidates
-    printf("All candidate motifs for m=%d are as follows:\n", m);
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    Output *file = output_open(fd);
+    uint64_t written = 0;
+    output_bytes(file, &header, sizeof(header));
+    output_bytes(file, table, n * sizeof(IndexSequence));
+    written = sizeof(header) + n * sizeof(IndexSequence);
+    output_pad(file, &written);
+    for (int i = 0; i < n; i++) {
+        output_bytes(file, dna_strings[i], l);
+    }
+    written += (uint64_t)n * l;
+    output_pad(file, &written);
+    for (int i = 0; i < n; i++) {
+        output_bytes(file, kmers + (size_t)i * num_positions, table[i].num_kmers * sizeof(uint32_t));
+        written += table[i].num_kmers * sizeof(uint32_t);
+        output_pad(file, &written);
+        output_bytes(file, starts + (size_t)i * (num_positions + 1), (table[i].num_kmers + 1) * sizeof(uint32_t));
+        written += (table[i].num_kmers + 1) * sizeof(uint32_t);
+        output_pad(file, &written);
+        output_bytes(file, positions + (size_t)i * num_positions, table[i].num_positions * sizeof(uint32_t));
+        written += table[i].num_positions * sizeof(uint32_t);
+        output_pad(file, &written);
+    }
+    output_close(file);
+    close(fd);
+
+    free(positions);
+    free(starts);
+    free(kmers);
+    free(table);
+    free(occurrences);
+    free(codes);
+    free(substrings);
+}
+
+// Function to get the sorted distinct codes of input string i of an index
+const uint32_t *index_kmers(const Index *index, int i) {
+    return (const uint32_t *)(index->map + index->table[i].kmers);
+}
 
-    for (int i = 0; i < total_combinations; i++) {      // for loop to print out candidates.
-    printf("%s ", (*candidates)[i]);
-    if ((i + 1) % 8 == 0) {
-        printf("\n");
+// Function to get the occurrence list bounds of input string i of an index
+const uint32_t *index_starts(const Index *index, int i) {
+    return (const uint32_t *)(index->map + index->table[i].starts);
+}
+
+// Function to get the occurrence offsets of input string i of an index
+const uint32_t *index_positions(const Index *index, int i) {
+    return (const uint32_t *)(index->map + index->table[i].positions);
+}
+
+// Function to check the occurrence lists of one string of a mapped index: the starts must run
+// from 0 up to num_positions without going back, and every offset must be a window of the string,
+// so no list reaches outside positions and no occurrence outside the string.
+int index_lists_valid(const Index *index, int i) {
+    const IndexSequence *entry = &index->table[i];
+    const uint32_t *starts = index_starts(index, i);
+    const uint32_t *positions = index_positions(index, i);
+    if (starts[0] != 0 || starts[entry->num_kmers] != entry->num_positions) {
+        return 0;
+    }
+    for (uint32_t k = 0; k < entry->num_kmers; k++) {
+        if (starts[k] > starts[k + 1]) {
+            return 0;
+        }
+    }
+    for (uint32_t k = 0; k < entry->num_positions; k++) {
+        if (positions[k] >= entry->num_positions) {
+            return 0;
+        }
     }
+    return 1;
 }
-printf("\n");
+
+// Function to check that bytes bytes from offset lie within a file of size bytes. Offsets come
+// from the file itself, so they are compared without adding them to anything that could wrap.
+int index_section_fits(uint64_t offset, uint64_t bytes, size_t size) {
+    return offset <= size && bytes <= size - offset;
 }
-// Function to generate substrings
-void gen_substrings(char *input_string, int l, int m, char ***substrings, int *num_substrings, int string_index) {
-    *num_substrings = l - m + 1;   // calculating number of substring of lenth m that are in the input string.
-    *substrings = (char **)malloc(*num_substrings * sizeof(char *));  // allocating memeory for the base array
-    if (*substrings == NULL) {  // checking if memeory allocation worked
+
+// Function to map a k-mer index written by build_index, checking that its layout is sound
+Index *load_index(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    Index *index = (Index *)malloc(sizeof(Index));
+    if (index == NULL) {
         printf("Memory allocation failed\n");
         exit(1);
     }
-    for (int i = 0; i < *num_substrings; i++) {        // iterating through lenght of the base array of the 2d array 
-        (*substrings)[i] = (char *)malloc((m + 1) * sizeof(char)); //allocting memeory for cols that will store substrings.
-        if ((*substrings)[i] == NULL) { // checking if memeory allocating worked.
-            printf("Memory allocation failed\n");
+    index->size = info.st_size;
+    index->map = (index->size >= sizeof(IndexHeader)) ? mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        fprintf(stderr, "%s: not a motif index\n", filename);
+        exit(1);
+    }
+    index->header = (const IndexHeader *)index->map;
+    index->table = (const IndexSequence *)(index->map + sizeof(IndexHeader));
+
+    const IndexHeader *header = index->header;
+    int valid = memcmp(header->magic, "MIDX", 4) == 0 && header->version == INDEX_VERSION
+                && header->n >= MIN_N && header->n <= MAX_N && header->l >= MIN_L && header->l <= MAX_L
+                && header->m >= MIN_M && header->m <= MAX_M && header->m <= header->l
+                && index_section_fits(sizeof(IndexHeader), (uint64_t)header->n * sizeof(IndexSequence), index->size)
+                && index_section_fits(header->sequences, (uint64_t)header->n * header->l, index->size);
+    for (uint32_t i = 0; valid && i < header->n; i++) {
+        const IndexSequence *entry = &index->table[i];
+        valid = entry->num_positions == header->l - header->m + 1 && entry->num_kmers <= entry->num_positions
+                && index_section_fits(entry->kmers, (uint64_t)entry->num_kmers * sizeof(uint32_t), index->size)
+                && index_section_fits(entry->starts, ((uint64_t)entry->num_kmers + 1) * sizeof(uint32_t), index->size)
+                && index_section_fits(entry->positions, (uint64_t)entry->num_positions * sizeof(uint32_t), index->size)
+                && entry->kmers % 4 == 0 && entry->starts % 4 == 0 && entry->positions % 4 == 0
+                && index_lists_valid(index, i);
+    }
+    if (!valid) {
+        fprintf(stderr, "%s: not a motif index\n", filename);
+        exit(1);
+    }
+    return index;
+}
+
+// Function to get input string i of an index (l characters, not terminated)
+char *index_sequence(const Index *index, int i) {
+    return index->map + index->header->sequences + (size_t)i * index->header->l;
+}
+
+// Function to unmap an index
+void unload_index(Index *index) {
+    munmap(index->map, index->size);
+    free(index);
+}
+
+// Function to order packed motifs
+int compare_motifs(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to read a motif subset, one motif of length m per line, as sorted packed motifs
+// without repeats. With both_strands a listed motif brings its reverse complement.
+uint32_t *read_subset_codes(const char *filename, int m, int both_strands, size_t *count) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    size_t capacity = 64;
+    size_t used = 0;
+    uint32_t *codes = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    char line[256];
+    while (codes != NULL && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (strlen(line) != m || strspn(line, "ACGT") != m) {
+            fprintf(stderr, "%s: invalid motif %s\n", filename, line);
             exit(1);
         }
-        strncpy((*substrings)[i], &input_string[i], m);  // copies m characters from input string into the ith element of the substrings
-        (*substrings)[i][m] = '\0';  // adds null terminator to end of string.
+        if (used + 2 > capacity) {
+            capacity *= 2;
+            uint32_t *grown = (uint32_t *)realloc(codes, capacity * sizeof(uint32_t));
+            if (grown == NULL) {
+                free(codes);
+            }
+            codes = grown;
+            if (codes == NULL) {
+                break;
+            }
+        }
+        uint32_t code = motif_encode_substring(line, m);
+        codes[used++] = code;
+        if (both_strands) {
+            codes[used++] = motif_reverse_complement(code, m);
+        }
+    }
+    fclose(file);
+    if (codes == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
     }
+    qsort(codes, used, sizeof(uint32_t), compare_motifs);
+    size_t distinct = 0;
+    for (size_t k = 0; k < used; k++) {
+        if (distinct == 0 || codes[k] != codes[distinct - 1]) {
+            codes[distinct++] = codes[k];
+        }
+    }
+    *count = distinct;
+    return codes;
+}
+
+// Function to read a motif subset, one motif of length m per line, as a candidate mask
+uint64_t *read_subset(const char *filename, size_t num_candidates, int m, int both_strands) {
+    size_t count;
+    uint32_t *codes = read_subset_codes(filename, m, both_strands, &count);
+    uint64_t *subset = bitset_alloc(num_candidates);
+    for (size_t k = 0; k < count; k++) {
+        subset[codes[k] / WORD_BITS] |= (uint64_t)1 << (codes[k] % WORD_BITS);
+    }
+    free(codes);
+    return subset;
+}
 
-    // Display all substrings
-    printf("All substrings of length %d from input string #%d are as follows:\n", m, string_index + 1);
+// Function to set in mask the listed motifs (sorted codes) that fall among the num_candidates
+// candidates from first on, clearing the rest. Chunks are visited in order, so the scan starts
+// at *next and leaves it at the first motif past this chunk. Returns how many were set.
+size_t subset_chunk(const uint32_t *codes, size_t count, size_t *next, size_t first, size_t num_candidates, uint64_t *mask) {
+    memset(mask, 0, BITSET_WORDS(num_candidates) * sizeof(uint64_t));
+    size_t set = 0;
+    while (*next < count && codes[*next] < first + num_candidates) {
+        size_t i = codes[*next] - first;
+        mask[i / WORD_BITS] |= (uint64_t)1 << (i % WORD_BITS);
+        (*next)++;
+        set++;
+    }
+    return set;
+}
+
+// Function to write a new session file holding the motifs found in all n input strings
+void save_session(const char *filename, const uint64_t *survivors, size_t num_candidates, char **dna_strings, int n, int l, int m, int h, int both_strands) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    SessionHeader header = {{'M', 'S', 'E', 'S'}, SESSION_VERSION, n, l, m, h, both_strands, 0, motif_bitset_count(survivors, num_candidates)};
+    Output *file = output_open(fd);
+    output_bytes(file, &header, sizeof(header));
+    output_bytes(file, survivors, BITSET_WORDS(num_candidates) * sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        output_bytes(file, dna_strings[i], l);
+    }
+    output_close(file);
+    close(fd);
+}
 
-    for (int i = 0; i < *num_substrings; i++) {    // looping through all substring and printing them out 
-        printf("%s ", (*substrings)[i]);   //prints ith element of substring.
+// Function to read the header and survivors of a session file, checking that its size matches
+uint64_t *load_session(const char *filename, SessionHeader *header) {
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        perror(filename);
+        exit(1);
     }
-    printf("\n");
+    int valid = read(fd, header, sizeof(*header)) == sizeof(*header)
+                && memcmp(header->magic, "MSES", 4) == 0 && header->version == SESSION_VERSION
+                && header->n >= MIN_N && header->n <= MAX_N && header->l >= MIN_L && header->l <= MAX_L
+                && header->m >= MIN_M && header->m <= MAX_M && header->m <= header->l && header->h <= header->m;
+    size_t num_candidates = valid ? (size_t)1 << (2 * header->m) : 0;
+    size_t bytes = BITSET_WORDS(num_candidates) * sizeof(uint64_t);
+    valid = valid && (uint64_t)info.st_size == sizeof(SessionHeader) + bytes + (uint64_t)header->n * header->l;
+    uint64_t *survivors = valid ? bitset_alloc(num_candidates) : NULL;
+    if (!valid || read(fd, survivors, bytes) != (ssize_t)bytes) {
+        fprintf(stderr, "%s: not a motif session\n", filename);
+        exit(1);
+    }
+    close(fd);
+    return survivors;
 }
 
-// Function to calculate Hamming distance
-int hamming_dist(char *str1, char *str2, int m) {
-    int dist = 0;
-    for (int i = 0; i < m; i++) {     // looping through each character postion in the motif
-        if (str1[i] != str2[i]) {    // comparing index in string 1 and 2 and if there not equal to each other we increment the distacne function
-            dist++;                 // and when str 1 and str2 have a same character 
-        }                           // we return the distance variable.
+// Function to add count input strings to a session file, along with the survivors left after them
+void update_session(const char *filename, SessionHeader *header, const uint64_t *survivors, char **dna_strings, int count) {
+    int fd = open(filename, O_WRONLY);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    size_t num_candidates = (size_t)1 << (2 * header->m);
+    size_t bytes = BITSET_WORDS(num_candidates) * sizeof(uint64_t);
+    off_t end = sizeof(SessionHeader) + bytes + (off_t)header->n * header->l;
+    int ok = 1;
+    for (int i = 0; i < count; i++) {
+        ok = ok && pwrite(fd, dna_strings[i], header->l, end + (off_t)i * header->l) == header->l;
+    }
+    // The strings go in before the header counts them, so an interrupted append leaves a file
+    // that fails the size check rather than one that silently misses strings
+    header->n += count;
+    header->count = motif_bitset_count(survivors, num_candidates);
+    ok = ok && pwrite(fd, survivors, bytes, sizeof(SessionHeader)) == (ssize_t)bytes;
+    ok = ok && pwrite(fd, header, sizeof(*header), 0) == sizeof(*header);
+    if (!ok) {
+        perror(filename);
+        exit(1);
     }
-    return dist;
+    close(fd);
 }
 
-// Function to match motifs in a string
-void match_motifs_in_string(char **candidates, int num_candidates, char **substrings, int num_substrings, int m, int h, int dna_string_index) {
-    printf("The following are the candidate motifs of length %d with at most %d mismatch with substrings from input string #%d:\n", m, h, dna_string_index + 1);
+// Function to report the motifs of one input string from its match set
+void match_motifs_in_string(Output *out, size_t num_candidates, const uint64_t *matches, int m, int h, int dna_string_index) {
+    output_printf(out, "The following are the candidate motifs of length %d with at most %d mismatch with substrings from input string #%d:\n", m, h, dna_string_index + 1);
 
+    char motif[MAX_M + 2];
     int motifs_printed = 0;
-    for (int i = 0; i < num_candidates; i++) {        
-        for (int j = 0; j < num_substrings; j++) {
-            if (hamming_dist(candidates[i], substrings[j], m) <= h) { // Check if motif matches the substring
-                printf("%s ", candidates[i]); // Print motif
-                motifs_printed++;
-                if (motifs_printed % 8 == 0) { // Print 8 motifs per line for readability
-                    printf("\n");
-                }
-                break; // Move to the next candidate once a match is found for the current one
+    for (size_t i = 0; i < num_candidates; i++) {
+        if (motif_bitset_test(matches, i)) { // Check if motif matches a substring of this string
+            motif_gen_candidate(i, m, motif);
+            motif[m] = ' ';
+            output_bytes(out, motif, m + 1); // Print motif
+            motifs_printed++;
+            if (motifs_printed % 8 == 0) { // Print 8 motifs per line for readability
+                output_bytes(out, "\n", 1);
             }
         }
     }
     if (motifs_printed % 8 != 0) {
-        printf("\n"); // Ensure a newline at the end if the last line wasn't full
+        output_bytes(out, "\n", 1); // Ensure a newline at the end if the last line wasn't full
     }
-    printf("\n");
+    output_bytes(out, "\n", 1);
 }
 
+// Function to report the motifs found in all input strings, or in at least quorum of them
+void print_common_motifs(Output *out, size_t num_candidates, const uint64_t *survivors, int m, int n, int quorum) {
+    if (quorum == n) {
+        output_printf(out, "The motifs found in all %d input strings are as follows:\n", n); // Header for motifs found in all strings
+    }
+    else {
+        output_printf(out, "The motifs found in at least %d of %d input strings are as follows:\n", quorum, n);
+    }
 
-// Function to find motifs common to all input strings
-int find_motifs(char **candidates, int num_candidates, char ***all_substrings, int *num_substrings, int n, int m, int h) {
-    int motif_count = 0; // Initialize count of motifs found in all strings
-    printf("The motifs found in all %d input strings are as follows:\n", n); // Header for motifs found in all strings
+    char motif[MAX_M + 2];
+    for (size_t i = 0; i < num_candidates; i++) {
+        if (motif_bitset_test(survivors, i)) { // If motif was found in all DNA strings
+            motif_gen_candidate(i, m, motif);
+            motif[m] = ' ';
+            output_bytes(out, motif, m + 1); // Print motif directly
+        }
+    }
+    output_bytes(out, "\n", 1); // Newline after all motifs have been printed
+}
 
-    for (int i = 0; i < num_candidates; i++) { // Loop through each candidate motif
-        int found_in_all = 1; // Flag to track if the motif is found in all DNA strings
-        
-        for (int j = 0; j < n; j++) { // Loop through each DNA string
-            int found_in_this_string = 0; // Flag to check if motif is found in current DNA string
-            
-            for (int k = 0; k < num_substrings[j]; k++) { // Loop through substrings of the j-th DNA string
-                if (hamming_dist(candidates[i], all_substrings[j][k], m) <= h) { // Compare motif and substring
-                    found_in_this_string = 1; // Motif matches a substring in this DNA string
-                    break; // Stop searching this DNA string since we found a match
-                }
+// Function to start a results file for the motifs found in all input strings, either as TSV
+// (one motif per row with the number of strings it was found in) or as packed 2-bit codes.
+// The motifs are added by results_add, possibly a chunk at a time, and results_close finishes
+// the file.
+Output *results_open(const char *filename, int format, int n, int m, int h) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    Output *results = output_open(fd);
+    if (format == FORMAT_BIN) {
+        ResultsHeader header = {{'M', 'O', 'T', 'F'}, m, h, n, 0};   // count is filled in on close
+        output_bytes(results, &header, sizeof(header));
+    }
+    else {
+        output_printf(results, "motif\tstrings\n");
+    }
+    return results;
+}
+
+// Function to add the motifs set in survivors, which covers the num_candidates candidates from
+// first on, to a results file. counts (indexed the same way) is NULL when every motif was found
+// in all n strings. Returns the number of motifs added.
+uint64_t results_add(Output *results, int format, size_t first, size_t num_candidates, const uint64_t *survivors, const HitCounts *counts, int n, int m) {
+    char motif[MAX_M + 1];
+    uint64_t added = 0;
+    for (size_t i = 0; i < num_candidates; i++) {
+        if (motif_bitset_test(survivors, i)) {
+            if (format == FORMAT_BIN) {
+                uint32_t code = (uint32_t)(first + i);   // candidate numbers are already 2-bit packed motifs
+                output_bytes(results, &code, sizeof(code));
             }
-            
-            if (!found_in_this_string) { // If the motif isn't found in this DNA string
-                found_in_all = 0; // Set flag to indicate the motif isn't in all DNA strings
-                break; // Exit the loop since the motif won't qualify
+            else {
+                motif_gen_candidate(first + i, m, motif);
+                output_printf(results, "%s\t%d\n", motif, (counts != NULL) ? motif_hit_count(counts, i) : n);
             }
+            added++;
         }
-        
-        if (found_in_all) { // If motif was found in all DNA strings
-            printf("%s ", candidates[i]); // Print motif directly
-            motif_count++; // Increment count of motifs found in all strings
+    }
+    return added;
+}
+
+// Function to finish a results file holding count motifs
+void results_close(Output *results, int format, uint64_t count) {
+    int fd = results->fd;
+    output_flush(results);
+    if (format == FORMAT_BIN && pwrite(fd, &count, sizeof(count), offsetof(ResultsHeader, count)) != sizeof(count)) {
+        perror("results");
+        exit(1);
+    }
+    output_close(results);
+    close(fd);
+}
+
+// Function to write the motifs found in all input strings to a results file
+void write_results(const char *filename, int format, size_t num_candidates, const uint64_t *survivors, const HitCounts *counts, int n, int m, int h) {
+    Output *results = results_open(filename, format, n, m, h);
+    uint64_t count = results_add(results, format, 0, num_candidates, survivors, counts, n, m);
+    results_close(results, format, count);
+}
+
+// Function to compare two (sort key, row) pairs for qsort
+int compare_rows(const void *a, const void *b) {
+    const uint64_t *x = (const uint64_t *)a;
+    const uint64_t *y = (const uint64_t *)b;
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+// Function to write the occurrences of the motifs found in all input strings to a positions
+// file, ordered by motif, string, offset and strand. Occurrences of candidates that were dropped later
+// in the search are left out. TSV has one occurrence per row; the binary format keeps the columns.
+void write_positions(const char *filename, int format, const Positions *positions, const uint64_t *survivors, int n, int m, int h) {
+    // Sort keys hold motif, string, offset and strand side by side (32 + 11 + 20 + 1 bits), each
+    // paired with the row it came from
+    uint64_t *rows = (uint64_t *)malloc(2 * (positions->count + 1) * sizeof(uint64_t));
+    if (rows == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    size_t count = 0;
+    for (size_t r = 0; r < positions->count; r++) {
+        if (motif_bitset_test(survivors, positions->motif[r])) {
+            rows[2 * count] = ((uint64_t)positions->motif[r] << 32) | ((uint64_t)positions->string[r] << 21) | ((uint64_t)positions->offset[r] << 1) | positions->strand[r];
+            rows[2 * count + 1] = r;
+            count++;
         }
     }
-    printf("\n"); // Newline after all motifs have been printed
-    return motif_count; // Return the number of motifs found in all DNA strings
+    qsort(rows, count, 2 * sizeof(uint64_t), compare_rows);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    Output *file = output_open(fd);
+    if (format == FORMAT_BIN) {
+        PositionsHeader header = {{'M', 'P', 'O', 'S'}, m, h, n, count};
+        output_bytes(file, &header, sizeof(header));
+        for (size_t i = 0; i < count; i++) {
+            output_bytes(file, &positions->motif[rows[2 * i + 1]], sizeof(uint32_t));
+        }
+        for (size_t i = 0; i < count; i++) {
+            output_bytes(file, &positions->string[rows[2 * i + 1]], sizeof(uint32_t));
+        }
+        for (size_t i = 0; i < count; i++) {
+            output_bytes(file, &positions->offset[rows[2 * i + 1]], sizeof(uint32_t));
+        }
+        for (size_t i = 0; i < count; i++) {
+            output_bytes(file, &positions->distance[rows[2 * i + 1]], sizeof(uint8_t));
+        }
+        for (size_t i = 0; i < count; i++) {
+            output_bytes(file, &positions->strand[rows[2 * i + 1]], sizeof(uint8_t));
+        }
+    }
+    else {
+        char motif[MAX_M + 1];
+        output_printf(file, "motif\tstring\toffset\tdistance\tstrand\n");
+        for (size_t i = 0; i < count; i++) {
+            size_t r = rows[2 * i + 1];
+            motif_gen_candidate(positions->motif[r], m, motif);
+            output_printf(file, "%s\t%u\t%u\t%u\t%c\n", motif, positions->string[r] + 1, positions->offset[r], positions->distance[r],
+                          positions->strand[r] ? '-' : '+');
+        }
+    }
+    output_close(file);
+    close(fd);
+    free(rows);
 }
 
+// Function to intersect the motifs found so far with count more input strings, one pass over
+// each, skipping the rest once nothing survives. Returns the number of motifs left.
+size_t append_motifs(size_t num_candidates, char **dna_strings, int count, int l, int m, int h, int both_strands, uint64_t *survivors) {
+    int per_string = l - m + 1;
+    Substring *substrings = (Substring *)malloc(per_string * sizeof(Substring));
+    uint32_t *codes = (uint32_t *)malloc(per_string * sizeof(uint32_t));
+    if (substrings == NULL || codes == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    int num_substrings;
+    motif_gen_substrings(l, m, substrings, &num_substrings);
+    for (int i = 0; i < count && !motif_bitset_empty(survivors, num_candidates); i++) {
+        PackedString packed = {codes, num_substrings, NULL, NULL};
+        motif_pack_substrings(dna_strings[i], substrings, num_substrings, m, codes);
+        if (both_strands) {
+            packed.num_codes = motif_canonical_substrings(codes, num_substrings, m);
+        }
+        motif_match_bitset(0, num_candidates, &packed, i, h, survivors, survivors, NULL, both_strands);
+    }
+    free(codes);
+    free(substrings);
+    return motif_bitset_count(survivors, num_candidates);
+}
 
-int main() {
-    int n, l, m, h;
-    char **dna_strings;
+// Function to turn a score into PWM_SCALE fixed point, rounding to nearest. Scores are checked
+// against PWM_MAX_SCORE and PWM_MAX_THRESHOLD first, so the result always fits.
+int32_t fixed_point(double score) {
+    return (int32_t)(score * PWM_SCALE + ((score >= 0) ? 0.5 : -0.5));
+}
 
-    printf("Basic Motif Search Program\n");
-    user_input(&n, &l, &m, &h, &dna_strings);
+// Function to read a weight matrix, one position per line with the log-odds scores of A, C, G
+// and T, into pair tables. Blank lines and lines starting with # are skipped. Windows scoring at
+// least threshold are hits.
+PwmTable *read_pwm(const char *filename, double threshold) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    double weights[MAX_M][4];
+    int m = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (m == MAX_M || sscanf(line, "%lf %lf %lf %lf", &weights[m][0], &weights[m][1], &weights[m][2], &weights[m][3]) != 4) {
+            fprintf(stderr, "%s: invalid weight matrix row %s", filename, line);
+            exit(1);
+        }
+        for (int b = 0; b < 4; b++) {
+            if (!(weights[m][b] >= -PWM_MAX_SCORE && weights[m][b] <= PWM_MAX_SCORE)) {   // also NaN
+                fprintf(stderr, "%s: weight matrix scores must be between %.0f and %.0f: %s", filename, -PWM_MAX_SCORE, PWM_MAX_SCORE, line);
+                exit(1);
+            }
+        }
+        m++;
+    }
+    fclose(file);
+    if (m < MIN_M) {
+        fprintf(stderr, "%s: a weight matrix needs at least %d positions\n", filename, MIN_M);
+        exit(1);
+    }
 
-    int num_candidates = (int)pow(4, m);
-    char **candidates;
-    gen_candidates(&candidates, m);
+    PwmTable *pwm = (PwmTable *)calloc(1, sizeof(PwmTable));
+    if (pwm == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    pwm->m = m;
+    pwm->pairs = (m + 1) / 2;
+    pwm->threshold = fixed_point(threshold);
+    for (int p = 0; p < pwm->pairs; p++) {
+        for (int b = 0; b < 16; b++) {
+            // An odd last position has no partner; the bits above a code are always clear
+            double score = weights[2 * p][b & 3] + ((2 * p + 1 < m) ? weights[2 * p + 1][b >> 2] : 0);
+            pwm->table[16 * p + b] = fixed_point(score);
+        }
+    }
+    return pwm;
+}
 
-    char ***all_substrings = (char ***)malloc(n * sizeof(char **));
-    if (all_substrings == NULL) {
+// Function to score every window of the input strings against a weight matrix and report the
+// windows reaching its threshold: the per-string counts, with the windows themselves at the
+// full level, and every window in results when it is not NULL. Returns how many strings have
+// at least one such window.
+int search_pwm(Output *out, Output *results, const PwmTable *pwm, char **dna_strings, int n, int l, int level) {
+    int m = pwm->m;
+    int per_string = l - m + 1;
+    Substring *substrings = (Substring *)malloc(per_string * sizeof(Substring));
+    uint32_t *codes = (uint32_t *)malloc(per_string * sizeof(uint32_t));
+    uint32_t *hits = (uint32_t *)malloc(per_string * sizeof(uint32_t));
+    int32_t *scores = (int32_t *)malloc(per_string * sizeof(int32_t));
+    if (substrings == NULL || codes == NULL || hits == NULL || scores == NULL) {
         printf("Memory allocation failed\n");
         exit(1);
     }
+    int num_substrings;
+    motif_gen_substrings(l, m, substrings, &num_substrings);
 
+    int strings_hit = 0;
+    for (int i = 0; i < n; i++) {
+        motif_pack_substrings(dna_strings[i], substrings, num_substrings, m, codes);
+        int found = motif_score_windows(pwm, codes, num_substrings, hits, scores);
+        strings_hit += (found > 0);
+        if (level != LEVEL_QUIET) {
+            output_printf(out, "Input string #%d: %d windows scoring at least %.3f\n", i + 1, found, (double)pwm->threshold / PWM_SCALE);
+        }
+        for (int k = 0; k < found; k++) {
+            const char *window = dna_strings[i] + substrings[hits[k]].offset;
+            if (level == LEVEL_FULL) {
+                output_printf(out, "%.*s at offset %d: %.3f\n", m, window, substrings[hits[k]].offset, (double)scores[k] / PWM_SCALE);
+            }
+            if (results != NULL) {
+                output_printf(results, "%d\t%d\t%.*s\t%.3f\n", i + 1, substrings[hits[k]].offset, m, window, (double)scores[k] / PWM_SCALE);
+            }
+        }
+        if (level == LEVEL_FULL) {
+            output_bytes(out, "\n", 1);
+        }
+    }
+
+    free(scores);
+    free(hits);
+    free(codes);
+    free(substrings);
+    return strings_hit;
+}
+
+// Function to pick how many candidates to search at a time in limit_mb megabytes, of which
+// fixed_bytes already hold the strings, their packed windows and any -m list. Each candidate
+// needs a survivor bit, a mask bit with a -m list, and when counting towards a quorum also a
+// bit for the current string's matches and a hit counter. Chunks are a power of two of at
+// least 64 candidates; returns 0 when not even that fits.
+size_t chunk_candidates(size_t limit_mb, size_t fixed_bytes, size_t num_candidates, int n, int counting, int masked) {
+    size_t limit = limit_mb << 20;
+    size_t bits = (counting ? 2 + 8 * ((n <= UINT8_MAX) ? sizeof(uint8_t) : sizeof(uint16_t)) : 1) + (masked ? 1 : 0);
+    size_t fit = (fixed_bytes < limit) ? ((limit - fixed_bytes) << 3) / bits : 0;
+    if (fit < WORD_BITS) {
+        return 0;
+    }
+    size_t chunk = WORD_BITS;
+    while (chunk < num_candidates && 2 * chunk <= fit) {
+        chunk *= 2;
+    }
+    return chunk;
+}
+
+// Function to print the command line options
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-q | -s] [-o FILE] [-t tsv|bin] [-k scalar|sse|avx2] [-b INDEX | -i INDEX] [-m MOTIFS] [-p FILE] [-Q q] [-r] [-S SESSION | -a SESSION] [-M MB] [-w PWM [-T SCORE]]\n", program);
+    fprintf(stderr, "  -q         quiet: print only the number of motifs found in all strings\n");
+    fprintf(stderr, "  -s         summary: per-string counts and the motifs found in all strings\n");
+    fprintf(stderr, "  -o FILE    write the motifs found in all strings to FILE\n");
+    fprintf(stderr, "  -t FMT     format of the -o file: tsv (default) or bin (packed 2-bit codes)\n");
+    fprintf(stderr, "  -k NAME    force a match kernel instead of the widest one the CPU supports\n");
+    fprintf(stderr, "  -b INDEX   read n, l, m and the strings, write a k-mer index to INDEX and stop\n");
+    fprintf(stderr, "  -i INDEX   search the strings of a k-mer index, reading only h\n");
+    fprintf(stderr, "  -m MOTIFS  only consider the motifs listed in MOTIFS, one per line\n");
+    fprintf(stderr, "  -p FILE    write every occurrence of the motifs found in all strings to FILE\n");
+    fprintf(stderr, "             (motif, string, offset, mismatches, strand; -t picks the format)\n");
+    fprintf(stderr, "  -Q q       report motifs found in at least q of the n strings instead of all\n");
+    fprintf(stderr, "  -r         search both strands: a motif also occurs where its reverse complement does\n");
+    fprintf(stderr, "  -S SESSION save the motifs found in all strings to SESSION for later appends\n");
+    fprintf(stderr, "  -a SESSION read more strings and intersect them with SESSION, updating it\n");
+    fprintf(stderr, "  -M MB      search the motif space in chunks that fit in MB megabytes (with -q)\n");
+    fprintf(stderr, "  -w PWM     score windows against a weight matrix (m rows of A C G T log-odds)\n");
+    fprintf(stderr, "             instead of matching motifs; the strings are read without h\n");
+    fprintf(stderr, "  -T SCORE   report windows scoring at least SCORE against the -w matrix (default 0)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int n, l, m, h;
+    char **dna_strings;
+    int level = LEVEL_FULL;
+    int format = FORMAT_TSV;
+    const char *results_file = NULL;
+    const char *kernel = NULL;
+    const char *build_file = NULL;
+    const char *index_file = NULL;
+    const char *subset_file = NULL;
+    const char *positions_file = NULL;
+    int quorum = 0;   // 0 means all n strings
+    int both_strands = 0;
+    const char *session_file = NULL;
+    const char *append_file = NULL;
+    size_t memory_limit = 0;   // megabytes, 0 means search every candidate at once
+    const char *pwm_file = NULL;
+    double threshold = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qso:t:k:b:i:m:p:Q:rS:a:M:w:T:")) != -1) {
+        switch (opt) {
+            case 'q': level = LEVEL_QUIET; break;
+            case 's': level = LEVEL_SUMMARY; break;
+            case 'o': results_file = optarg; break;
+            case 'k': kernel = optarg; break;
+            case 'b': build_file = optarg; break;
+            case 'i': index_file = optarg; break;
+            case 'm': subset_file = optarg; break;
+            case 'p': positions_file = optarg; break;
+            case 'r': both_strands = 1; break;
+            case 'S': session_file = optarg; break;
+            case 'a': append_file = optarg; break;
+            case 'Q':
+                quorum = atoi(optarg);
+                if (quorum < 1) { usage(argv[0]); return 1; }
+                break;
+            case 'w': pwm_file = optarg; break;
+            case 'T': {
+                char *end;
+                threshold = strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || !(threshold >= -PWM_MAX_THRESHOLD && threshold <= PWM_MAX_THRESHOLD)) {
+                    fprintf(stderr, "-T must be a number between %.0f and %.0f\n", -PWM_MAX_THRESHOLD, PWM_MAX_THRESHOLD);
+                    return 1;
+                }
+                break;
+            }
+            case 'M':
+                memory_limit = (atoi(optarg) > 0) ? (size_t)atoi(optarg) : 0;
+                if (memory_limit == 0) { usage(argv[0]); return 1; }
+                break;
+            case 't':
+                if (strcmp(optarg, "tsv") == 0) { format = FORMAT_TSV; }
+                else if (strcmp(optarg, "bin") == 0) { format = FORMAT_BIN; }
+                else { usage(argv[0]); return 1; }
+                break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if ((build_file != NULL && index_file != NULL) || (build_file != NULL && session_file != NULL)
+        || (append_file != NULL && (build_file != NULL || index_file != NULL || session_file != NULL || subset_file != NULL
+                                    || positions_file != NULL || quorum != 0))
+        || (memory_limit != 0 && (level != LEVEL_QUIET || build_file != NULL || append_file != NULL
+                                  || session_file != NULL || positions_file != NULL))
+        || (pwm_file != NULL && (build_file != NULL || index_file != NULL || append_file != NULL || session_file != NULL
+                                 || subset_file != NULL || positions_file != NULL || quorum != 0 || both_strands
+                                 || memory_limit != 0 || format != FORMAT_TSV))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!motif_select_kernel(kernel)) {
+        fprintf(stderr, "Match kernel %s is not available on this CPU\n", kernel);
+        return 1;
+    }
+
+    // Prompts only make sense for a person typing, or when the full listing is wanted anyway
+    int prompt = (level == LEVEL_FULL) || isatty(STDIN_FILENO);
+    if (prompt) {
+        printf("Basic Motif Search Program\n");
+    }
+
+    // Index build: the strings are read and indexed, h is not needed
+    if (build_file != NULL) {
+        user_input(&n, &l, &m, NULL, &dna_strings, prompt);
+        build_index(build_file, dna_strings, n, l, m);
+        if (level != LEVEL_QUIET) {
+            printf("Indexed %d input strings of length %d for motifs of length %d into %s\n", n, l, m, build_file);
+        }
+        free(dna_strings[0]);
+        free(dna_strings);
+        return 0;
+    }
+
+    // Weight matrix search: the strings are read without h, and every window is scored
+    if (pwm_file != NULL) {
+        PwmTable *pwm = read_pwm(pwm_file, threshold);
+        user_input(&n, &l, &m, NULL, &dna_strings, prompt);
+        if (m != pwm->m) {
+            fprintf(stderr, "%s: the weight matrix has %d positions, not %d\n", pwm_file, pwm->m, m);
+            return 1;
+        }
+        fflush(stdout);
+        Output *out = output_open(STDOUT_FILENO);
+        Output *results = NULL;
+        int fd = -1;
+        if (results_file != NULL) {
+            fd = open(results_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                perror(results_file);
+                exit(1);
+            }
+            results = output_open(fd);
+            output_printf(results, "string\toffset\twindow\tscore\n");
+        }
+        int strings_hit = search_pwm(out, results, pwm, dna_strings, n, l, level);
+        output_printf(out, "%d of %d input strings have a window scoring at least %.3f\n", strings_hit, n, (double)pwm->threshold / PWM_SCALE);
+        output_close(out);
+        if (results != NULL) {
+            output_close(results);
+            close(fd);
+        }
+        free(pwm);
+        free(dna_strings[0]);
+        free(dna_strings);
+        return 0;
+    }
+
+    // Session append: only the new strings are read, and each is intersected once with the
+    // motifs the session found so far. h, the strand mode and any -m restriction carry over.
+    if (append_file != NULL) {
+        SessionHeader session;
+        uint64_t *survivors = load_session(append_file, &session);
+        if (session.n >= MAX_N) {
+            fprintf(stderr, "%s: session already holds %d input strings\n", append_file, MAX_N);
+            return 1;
+        }
+        int count;
+        do {
+            if (prompt) printf("Please enter the number of input strings to append: ");
+            read_int(&count);
+        } while (count < 1 || count > MAX_N - (int)session.n);
+        read_strings(&dna_strings, count, session.l, session.n, prompt);
+
+        n = session.n + count;
+        m = session.m;
+        h = session.h;
+        size_t num_candidates = (size_t)1 << (2 * m);
+        size_t motif_count = append_motifs(num_candidates, dna_strings, count, session.l, m, h, session.both_strands, survivors);
+        update_session(append_file, &session, survivors, dna_strings, count);
+
+        fflush(stdout);
+        Output *out = output_open(STDOUT_FILENO);
+        if (level != LEVEL_QUIET) {
+            print_common_motifs(out, num_candidates, survivors, m, n, n);
+        }
+        else {
+            output_printf(out, "%zu motifs found in all %d input strings\n", motif_count, n);
+        }
+        output_close(out);
+        if (results_file != NULL) {
+            write_results(results_file, format, num_candidates, survivors, NULL, n, m, h);
+        }
+        free(survivors);
+        free(dna_strings[0]);
+        free(dna_strings);
+        return 0;
+    }
+
+    // Index query: the strings and their distinct m-mers come from the mapped index
+    Index *index = NULL;
+    if (index_file != NULL) {
+        index = load_index(index_file);
+        n = index->header->n;
+        l = index->header->l;
+        m = index->header->m;
+        read_mismatches(&h, m, prompt);
+        dna_strings = (char **)malloc(n * sizeof(char *));
+        if (dna_strings == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            dna_strings[i] = index_sequence(index, i);
+        }
+    }
+    else {
+        user_input(&n, &l, &m, &h, &dna_strings, prompt);
+    }
+    if (quorum > n) {
+        fprintf(stderr, "A quorum of %d cannot be met by %d input strings\n", quorum, n);
+        return 1;
+    }
+    if (quorum == 0) {
+        quorum = n;
+    }
+    if (session_file != NULL && quorum < n) {
+        fprintf(stderr, "Sessions keep the motifs found in all strings and cannot be used with -Q\n");
+        return 1;
+    }
+    fflush(stdout);   // from here on everything goes through the output buffer
+    Output *out = output_open(STDOUT_FILENO);
+
+    size_t num_candidates = (size_t)1 << (2 * m);   // 4^m
+    // A chunked search keeps a -m list as sorted codes and masks one chunk at a time, so the
+    // list never costs a bitset over the whole motif space
+    uint64_t *subset = NULL;
+    uint32_t *subset_codes = NULL;
+    size_t subset_count = 0;
+    if (subset_file != NULL && memory_limit != 0) {
+        subset_codes = read_subset_codes(subset_file, m, both_strands, &subset_count);
+    }
+    else if (subset_file != NULL) {
+        subset = read_subset(subset_file, num_candidates, m, both_strands);
+    }
+    if (level == LEVEL_FULL) {
+        gen_candidates(out, num_candidates, m, subset);
+    }
+
+    // One array of views for every string, indexed through per-string row pointers. The
+    // comparisons run on packed codes: every window of the string, or with an index only the
+    // distinct ones. A two-strand search without positions compares each window and its
+    // reverse complement once, through their shared canonical code. A chunked one compares
+    // both orientations instead, since a chunk does not hold the reverse complements of its
+    // candidates.
+    int per_string = l - m + 1;
+    Substring *substring_block = (Substring *)malloc((size_t)n * per_string * sizeof(Substring));
+    Substring **all_substrings = (Substring **)malloc(n * sizeof(Substring *));
     int *num_substrings = (int *)malloc(n * sizeof(int));
-    if (num_substrings == NULL) {
+    uint32_t *code_block = (index == NULL) ? (uint32_t *)malloc((size_t)n * per_string * sizeof(uint32_t)) : NULL;
+    int mirrored = both_strands && memory_limit != 0;
+    int canonical = both_strands && positions_file == NULL && !mirrored;
+    int row_size = mirrored ? 2 * per_string : per_string;
+    uint32_t *canonical_block = (canonical || mirrored) ? (uint32_t *)malloc((size_t)n * row_size * sizeof(uint32_t)) : NULL;
+    PackedString *packed = (PackedString *)calloc(n, sizeof(PackedString));
+    if (substring_block == NULL || all_substrings == NULL || num_substrings == NULL || (index == NULL && code_block == NULL)
+        || ((canonical || mirrored) && canonical_block == NULL) || packed == NULL) {
         printf("Memory allocation failed\n");
         exit(1);
     }
 
     for (int i = 0; i < n; i++) {
-        gen_substrings(dna_strings[i], l, m, &all_substrings[i], &num_substrings[i], i);
+        all_substrings[i] = substring_block + (size_t)i * per_string;
+        motif_gen_substrings(l, m, all_substrings[i], &num_substrings[i]);
+        if (index != NULL) {
+            packed[i].codes = index_kmers(index, i);
+            packed[i].num_codes = index->table[i].num_kmers;
+            packed[i].starts = index_starts(index, i);
+            packed[i].positions = index_positions(index, i);
+        }
+        else {
+            motif_pack_substrings(dna_strings[i], all_substrings[i], num_substrings[i], m, code_block + (size_t)i * per_string);
+            packed[i].codes = code_block + (size_t)i * per_string;
+            packed[i].num_codes = num_substrings[i];
+        }
+        if (canonical || mirrored) {
+            uint32_t *row = canonical_block + (size_t)i * row_size;
+            memcpy(row, packed[i].codes, packed[i].num_codes * sizeof(uint32_t));
+            packed[i].codes = row;
+            packed[i].num_codes = canonical ? motif_canonical_substrings(row, packed[i].num_codes, m)
+                                            : motif_both_strand_substrings(row, packed[i].num_codes, m);
+            packed[i].starts = NULL;
+            packed[i].positions = NULL;
+        }
+        if (level == LEVEL_FULL) {
+            print_substrings(out, dna_strings[i], all_substrings[i], num_substrings[i], m, i);
+        }
+    }
 
+    // Single pass over the data: every string's match set is computed once, and both the
+    // per-string report and the intersection over all strings are read from it. Quiet runs
+    // have no per-string report, so they skip the sets and let motif_find_motifs prune as it goes.
+    // Occurrences are recorded by the same scans when a positions file is wanted.
+    Positions *positions = (positions_file != NULL) ? positions_alloc(m, both_strands) : NULL;
+    uint64_t **match_sets = NULL;
+    if (level != LEVEL_QUIET) {
+        match_sets = (uint64_t **)malloc(n * sizeof(uint64_t *));
+        if (match_sets == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            match_sets[i] = bitset_alloc(num_candidates);
+            motif_match_bitset(0, num_candidates, &packed[i], i, h, subset, match_sets[i], positions, both_strands);
+            if (level == LEVEL_FULL) {
+                match_motifs_in_string(out, num_candidates, match_sets[i], m, h, i);
+            }
+            else {
+                output_printf(out, "Input string #%d: %zu candidate motifs of length %d with at most %d mismatch\n",
+                              i + 1, motif_bitset_count(match_sets[i], num_candidates), m, h);
+            }
+        }
     }
 
-    for (int i = 0; i < n; i++) {
-        match_motifs_in_string(candidates, num_candidates, all_substrings[i], num_substrings[i], m, h, i);
+    uint64_t *survivors;
+    HitCounts *counts;
+    SearchScratch *scratch;
+    size_t motif_count = 0;
+    if (memory_limit == 0) {
+        survivors = bitset_alloc(num_candidates);
+        counts = (quorum < n) ? hit_counts_alloc(num_candidates, n) : NULL;
+        scratch = search_scratch_alloc(n, row_size, num_candidates, quorum < n);
+        motif_count = motif_find_motifs(0, num_candidates, match_sets, packed, n, h, subset, survivors, positions, quorum, counts, both_strands, scratch);
+        if (positions != NULL && positions->failed) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    else {
+        // Chunked search: the candidate space is cut into chunks that fit the memory limit, each
+        // chunk is searched against all strings, and its motifs are written out before the next
+        // one starts. Only quiet runs are chunked, so nothing needs the whole result at once.
+        // The limit also covers what does not shrink with the chunks: the strings, their
+        // windows and packed codes, the search scratch and the -m list.
+        size_t fixed = (index != NULL) ? index->size : (size_t)n * (l + 2);
+        fixed += (size_t)n * per_string * sizeof(Substring);
+        fixed += (code_block != NULL) ? (size_t)n * per_string * sizeof(uint32_t) : 0;
+        fixed += (canonical_block != NULL) ? (size_t)n * row_size * sizeof(uint32_t) : 0;
+        fixed += (size_t)row_size * sizeof(uint32_t) + (size_t)n * (sizeof(int) + sizeof(size_t));
+        fixed += subset_count * sizeof(uint32_t);
+        size_t chunk = chunk_candidates(memory_limit, fixed, num_candidates, n, quorum < n, subset_codes != NULL);
+        if (chunk == 0) {
+            fprintf(stderr, "-M %zu leaves no room to search: the strings and their windows take %zu MB\n",
+                    memory_limit, (fixed + (1 << 20) - 1) >> 20);
+            return 1;
+        }
+        survivors = bitset_alloc(chunk);
+        counts = (quorum < n) ? hit_counts_alloc(chunk, n) : NULL;
+        scratch = search_scratch_alloc(n, row_size, chunk, quorum < n);
+        uint64_t *mask = (subset_codes != NULL) ? bitset_alloc(chunk) : NULL;
+        size_t next_code = 0;
+        Output *results = (results_file != NULL) ? results_open(results_file, format, n, m, h) : NULL;
+        for (size_t first = 0; first < num_candidates; first += chunk) {
+            if (mask != NULL && subset_chunk(subset_codes, subset_count, &next_code, first, chunk, mask) == 0) {
+                continue;   // no listed motif in this chunk
+            }
+            if (counts != NULL) {
+                motif_hit_counts_clear(counts, chunk);
+            }
+            motif_count += motif_find_motifs(first, chunk, NULL, packed, n, h, mask, survivors, NULL, quorum, counts, 0, scratch);
+            if (results != NULL) {
+                results_add(results, format, first, chunk, survivors, counts, n, m);
+            }
+        }
+        if (results != NULL) {
+            results_close(results, format, motif_count);
+        }
+        free(mask);
+    }
+    if (level != LEVEL_QUIET) {
+        print_common_motifs(out, num_candidates, survivors, m, n, quorum);
+    }
+    else if (quorum == n) {
+        output_printf(out, "%zu motifs found in all %d input strings\n", motif_count, n);
     }
+    else {
+        output_printf(out, "%zu motifs found in at least %d of %d input strings\n", motif_count, quorum, n);
+    }
+    output_close(out);
 
-    find_motifs(candidates, num_candidates, all_substrings, num_substrings, n, m, h);
+    if (results_file != NULL && memory_limit == 0) {
+        write_results(results_file, format, num_candidates, survivors, counts, n, m, h);
+    }
+    if (session_file != NULL) {
+        save_session(session_file, survivors, num_candidates, dna_strings, n, l, m, h, both_strands);
+    }
+    if (positions_file != NULL) {
+        write_positions(positions_file, format, positions, survivors, n, m, h);
+        positions_free(positions);
+    }
 
     // Freeing allocated memory
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < num_substrings[i]; j++) {
-            free(all_substrings[i][j]);
-            all_substrings[i][j] = NULL;
+    if (match_sets != NULL) {
+        for (int i = 0; i < n; i++) {
+            free(match_sets[i]);
         }
-        free(all_substrings[i]);
-        all_substrings[i] = NULL;
-        free(dna_strings[i]);
-        dna_strings[i] = NULL;
+        free(match_sets);
+        match_sets = NULL;
     }
+    if (counts != NULL) {
+        hit_counts_free(counts);
+    }
+    search_scratch_free(scratch);
+    free(subset);
+    free(subset_codes);
+    free(survivors);
+    survivors = NULL;
+    free(code_block);
+    code_block = NULL;
+    free(canonical_block);
+    canonical_block = NULL;
+    free(packed);
+    packed = NULL;
+    free(substring_block);
+    substring_block = NULL;
     free(all_substrings);
     all_substrings = NULL;
+    if (index != NULL) {
+        unload_index(index);
+    }
+    else {
+        free(dna_strings[0]);
+    }
     free(dna_strings);
     dna_strings = NULL;
-    for (int i = 0; i < num_candidates; i++) {
-        free(candidates[i]);
-        candidates[i] = NULL;
-    }
-    free(candidates);
-    candidates = NULL;
     free(num_substrings);
     num_substrings = NULL;
 
     return 0;
 }
-